@@ -0,0 +1,37 @@
+#!/bin/bash
+#
+# Command lines of the benchmarks, sourced by runsim.sh and sweep.sh.
+#
+# set_benchmark <benchmark> sets
+#   bench_cmd     the benchmark binary followed by its arguments
+#   bench_stdin   file to feed on standard input, or empty
+#   bench_inputs  input files the results depend on
+
+set_benchmark() {
+    bench_stdin=''
+    bench_inputs=()
+    if [[ $1 == 'sjeng' ]] ; then
+        bench_cmd=("$SJENG_PATH/sjeng_base.amd64-m64-gcc41-nn" "$SJENG_PATH/ref.txt")
+        bench_inputs=("$SJENG_PATH/ref.txt")
+    elif [[ $1 == 'gobmk' ]] ; then
+        bench_cmd=("$GOBMK_PATH/gobmk_base.amd64-m64-gcc41-nn" --quiet --mode gtp)
+        bench_stdin="$GOBMK_PATH/13x13.tst"
+        bench_inputs=("$bench_stdin")
+    elif [[ $1 == 'gromacs' ]] ; then
+        bench_cmd=("$GROMACS_PATH/gromacs_base.amd64-m64-gcc41-nn" -silent -deffnm "$GROMACS_DATA/gromacs")
+        bench_inputs=("$GROMACS_DATA/gromacs.tpr")
+    elif [[ $1 == 'test' ]] ; then
+        bench_cmd=(../tests/test.out)
+    elif [[ -x ../tests/workloads/$1.out ]] ; then
+        # synthetic workloads, built with make in ../tests
+        bench_cmd=("../tests/workloads/$1.out")
+    else
+        return 1
+    fi
+}
+
+# Print a hash of the benchmark binary and its input files, after
+# set_benchmark, naming the benchmark's branch profile
+benchmark_hash() {
+    sha256sum "${bench_cmd[0]}" "${bench_inputs[@]}" | cut -d' ' -f1 | sha256sum | cut -d' ' -f1
+}
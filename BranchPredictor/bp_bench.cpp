@@ -0,0 +1,226 @@
+// Throughput microbenchmark of the predictors: time getPrediction() plus
+// train() per branch on synthetic branch streams and captured traces, across
+// table sizes, repeating every measurement to show how stable it is.
+//
+// Usage: bp_bench [-branches N] [-repeats N] [-min_size N] [-max_size N]
+//                 [-size_step N] [-trace file]... [type...]
+//
+// Tables that outgrow the caches show up as a jump in ns/branch with size.
+//
+#include "trace_replay.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+using std::cerr;
+using std::endl;
+using std::string;
+
+// Default number of branches of every stream
+//
+#define BENCH_BRANCHES (1 << 20)
+
+// Default number of timed runs of every measurement
+//
+#define BENCH_REPEATS 5
+
+// Default range of table sizes
+//
+#define BENCH_MIN_SIZE 128
+#define BENCH_MAX_SIZE (1 << 22)
+#define BENCH_SIZE_STEP 4
+
+static const char *const BENCH_TYPES[] = {"always_taken", "bimodal", "local",
+                                          "gshare", "tournament",
+                                          "tournament_interleaved", "gskew",
+                                          "2bc_gskew", "bi_mode", "yags",
+                                          "agree"};
+
+struct BenchStream {
+    string name;
+    std::vector<UINT64> records;
+};
+
+static int Usage() {
+    cerr << "This tool measures the throughput of the branch predictors" << endl
+         << endl
+         << "Usage: bp_bench [-branches N] [-repeats N] [-min_size N] "
+            "[-max_size N] [-size_step N] [-trace file]... [type...]"
+         << endl;
+    return -1;
+}
+
+// xorshift64, so that the synthetic streams are the same on every run
+//
+static UINT64 NextRandom(UINT64 &state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+// A stream over staticBranches static branches: a quarter biased, a quarter
+// loop exits, a quarter correlated with the previous outcome and a quarter
+// random, visited in runs of consecutive branches like basic blocks
+//
+static void SynthesizeStream(BenchStream &stream, const string &name,
+                             UINT32 staticBranches, UINT64 branchCount) {
+    UINT64 state = 0x9E3779B97F4A7C15ULL ^ staticBranches;
+    std::vector<UINT32> loopCounts(staticBranches, 0);
+    bool lastTaken = false;
+    UINT32 branch = 0;
+
+    stream.name = name;
+    stream.records.resize(branchCount);
+    for (UINT64 i = 0; i < branchCount; i++) {
+        if (NextRandom(state) % 8 == 0)
+            branch = NextRandom(state) % staticBranches;
+        else
+            branch = (branch + 1) % staticBranches;
+
+        bool taken;
+        switch (branch % 4) {
+        case 0:
+            taken = NextRandom(state) % 32 != 0;
+            break;
+        case 1:
+            taken = ++loopCounts[branch] % (2 + branch % 15) != 0;
+            break;
+        case 2:
+            taken = lastTaken ^ (NextRandom(state) % 16 == 0);
+            break;
+        default:
+            taken = NextRandom(state) & 1;
+        }
+        lastTaken = taken;
+        stream.records[i] = EncodeBranchRecord(0x400000 + branch * 6, taken);
+    }
+}
+
+// Read up to branchCount branches of a trace into memory, so that reading is
+// not timed
+//
+static bool LoadTrace(BenchStream &stream, const string &path, UINT64 branchCount) {
+    BranchTraceReader reader;
+    if (!reader.Open(path))
+        return false;
+    std::vector<UINT64> buffer;
+    stream.name = path;
+    stream.records.clear();
+    while (stream.records.size() < branchCount) {
+        size_t count = branchCount - stream.records.size();
+        const UINT64 *records = reader.Next(buffer, count);
+        if (count == 0)
+            break;
+        stream.records.insert(stream.records.end(), records, records + count);
+    }
+    if (stream.records.size() > branchCount)
+        stream.records.resize(branchCount);
+    return !reader.Failed() && !stream.records.empty();
+}
+
+int main(int argc, char *argv[]) {
+    UINT64 branchCount = BENCH_BRANCHES;
+    unsigned repeats = BENCH_REPEATS;
+    UINT64 minSize = BENCH_MIN_SIZE;
+    UINT64 maxSize = BENCH_MAX_SIZE;
+    UINT64 sizeStep = BENCH_SIZE_STEP;
+    std::vector<string> tracePaths;
+    std::vector<string> types;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-branches" && i + 1 < argc) {
+            branchCount = strtoull(argv[++i], NULL, 0);
+        } else if (arg == "-repeats" && i + 1 < argc) {
+            repeats = atoi(argv[++i]);
+        } else if (arg == "-min_size" && i + 1 < argc) {
+            minSize = strtoull(argv[++i], NULL, 0);
+        } else if (arg == "-max_size" && i + 1 < argc) {
+            maxSize = strtoull(argv[++i], NULL, 0);
+        } else if (arg == "-size_step" && i + 1 < argc) {
+            sizeStep = strtoull(argv[++i], NULL, 0);
+        } else if (arg == "-trace" && i + 1 < argc) {
+            tracePaths.push_back(argv[++i]);
+        } else if (arg[0] == '-') {
+            return Usage();
+        } else {
+            types.push_back(arg);
+        }
+    }
+    if (branchCount == 0 || repeats == 0 || minSize == 0 || maxSize < minSize ||
+        sizeStep < 2)
+        return Usage();
+    if (types.empty())
+        types.assign(BENCH_TYPES, BENCH_TYPES + sizeof(BENCH_TYPES) / sizeof(BENCH_TYPES[0]));
+
+    std::vector<UINT64> sizes;
+    for (UINT64 size = minSize; size < maxSize; size *= sizeStep)
+        sizes.push_back(size);
+    sizes.push_back(maxSize);
+
+    std::vector<BenchStream> streams(2 + tracePaths.size());
+    SynthesizeStream(streams[0], "synthetic_1k", 1 << 10, branchCount);
+    SynthesizeStream(streams[1], "synthetic_64k", 1 << 16, branchCount);
+    for (size_t i = 0; i < tracePaths.size(); i++) {
+        if (!LoadTrace(streams[2 + i], tracePaths[i], branchCount)) {
+            cerr << "Error: cannot read trace file " << tracePaths[i] << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::cout << "Stream\tPredictor\tStorage (KB)\tns/branch\tMbranches/s"
+                 "\tMin ns/branch\tMax ns/branch\tSpread"
+              << endl;
+    UINT64 checksum = 0;
+    for (size_t s = 0; s < streams.size(); s++) {
+        const BenchStream &stream = streams[s];
+        for (size_t t = 0; t < types.size(); t++) {
+            for (size_t z = 0; z < sizes.size(); z++) {
+                std::ostringstream spec;
+                spec << types[t] << ":" << sizes[z];
+                double storageKB = 0;
+                std::vector<double> nsPerBranch;
+                for (unsigned r = 0; r < repeats; r++) {
+                    BranchPredictorInterface *predictor =
+                        CreatePredictorFromSpec(spec.str());
+                    if (predictor == NULL) {
+                        cerr << "Error: No such branch predictor " << types[t]
+                             << endl;
+                        return EXIT_FAILURE;
+                    }
+                    storageKB = predictor->getStorageBits() / 8192.0;
+
+                    ReplayStats stats;
+                    std::chrono::steady_clock::time_point start =
+                        std::chrono::steady_clock::now();
+                    ReplayRecords(predictor, &stream.records[0],
+                                  stream.records.size(), stats);
+                    double seconds = std::chrono::duration<double>(
+                                         std::chrono::steady_clock::now() - start)
+                                         .count();
+                    nsPerBranch.push_back(seconds * 1e9 / stream.records.size());
+                    checksum += stats.correctPredictionCount;
+                    delete predictor;
+                }
+
+                std::sort(nsPerBranch.begin(), nsPerBranch.end());
+                double median = nsPerBranch[nsPerBranch.size() / 2];
+                std::cout << stream.name << "\t" << spec.str() << "\t"
+                          << storageKB << "\t" << std::fixed
+                          << std::setprecision(2) << median << "\t"
+                          << 1e3 / median << "\t" << nsPerBranch.front() << "\t"
+                          << nsPerBranch.back() << "\t"
+                          << std::setprecision(1)
+                          << 100 * (nsPerBranch.back() - nsPerBranch.front()) / median
+                          << "%" << std::defaultfloat << std::setprecision(6)
+                          << endl;
+            }
+        }
+    }
+    // keeps the replays from being optimized away
+    cerr << "Checksum " << checksum << endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,318 @@
+// Regenerate the result charts from the CSV written by sweep.sh: accuracy and
+// MPKI against table size for every benchmark, and the simulation speed of
+// every configuration.
+//
+// Usage: bp_plot [-d outdir] <results.csv>
+//
+#include "svg_writer.h"
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <iostream>
+#include <map>
+
+using std::cerr;
+using std::endl;
+using std::string;
+
+typedef std::vector<std::pair<double, double> > Points;
+
+// Series colours, the same palette as the original charts
+//
+static const char *const SERIES_COLOURS[] = {
+    "#4285f4", "#ea4335", "#fbbc04", "#34a853", "#ff6d01", "#46bdc6",
+    "#7baaf7", "#f07b72", "#fcd04f", "#71c287"};
+static const size_t SERIES_COLOUR_COUNT =
+    sizeof(SERIES_COLOURS) / sizeof(SERIES_COLOURS[0]);
+
+struct SweepResult {
+    string benchmark;
+    string series;
+    double numberOfEntries;
+    double accuracy;
+    double mpki;
+    double mips;
+};
+
+static int Usage() {
+    cerr << "This tool draws the result charts of a sweep" << endl
+         << endl
+         << "Usage: bp_plot [-d outdir] <results.csv>" << endl;
+    return -1;
+}
+
+// Split a CSV line into its fields, which may be quoted with double quotes
+//
+static std::vector<string> SplitCsvLine(const string &line) {
+    std::vector<string> fields(1);
+    bool quoted = false;
+    for (size_t i = 0; i < line.size(); i++) {
+        if (quoted && line[i] == '"' && i + 1 < line.size() && line[i + 1] == '"') {
+            fields.back() += '"';
+            i++;
+        } else if (line[i] == '"') {
+            quoted = !quoted;
+        } else if (line[i] == ',' && !quoted) {
+            fields.push_back("");
+        } else {
+            fields.back() += line[i];
+        }
+    }
+    return fields;
+}
+
+static bool ReadResults(const string &path, std::vector<SweepResult> &results) {
+    std::ifstream file(path.c_str());
+    string line;
+    if (!std::getline(file, line))
+        return false;
+
+    std::map<string, size_t> columns;
+    std::vector<string> header = SplitCsvLine(line);
+    for (size_t i = 0; i < header.size(); i++)
+        columns[header[i]] = i;
+    const char *required[] = {"benchmark", "bp_type", "num_bp_entries", "knobs",
+                              "accuracy", "conditional_branches",
+                              "correct_predictions", "instructions",
+                              "wall_seconds", "status"};
+    for (size_t i = 0; i < sizeof(required) / sizeof(required[0]); i++) {
+        if (columns.find(required[i]) == columns.end()) {
+            cerr << "Error: " << path << " has no column " << required[i] << endl;
+            return false;
+        }
+    }
+
+    while (std::getline(file, line)) {
+        std::vector<string> fields = SplitCsvLine(line);
+        if (fields.size() != header.size() || fields[columns["status"]] != "0" ||
+            fields[columns["accuracy"]].empty())
+            continue;
+
+        SweepResult result;
+        result.benchmark = fields[columns["benchmark"]];
+        result.series = fields[columns["bp_type"]];
+        if (!fields[columns["knobs"]].empty())
+            result.series += " " + fields[columns["knobs"]];
+        result.numberOfEntries = atof(fields[columns["num_bp_entries"]].c_str());
+        result.accuracy = atof(fields[columns["accuracy"]].c_str());
+
+        double branches = atof(fields[columns["conditional_branches"]].c_str());
+        double correct = atof(fields[columns["correct_predictions"]].c_str());
+        double instructions = atof(fields[columns["instructions"]].c_str());
+        double seconds = atof(fields[columns["wall_seconds"]].c_str());
+        result.mpki = instructions > 0 ? (branches - correct) * 1000 / instructions : 0;
+        result.mips = seconds > 0 ? instructions / seconds / 1e6 : 0;
+        results.push_back(result);
+    }
+    return true;
+}
+
+// Round a step between axis ticks up to 1, 2 or 5 times a power of ten
+//
+static double NiceStep(double range, int ticks) {
+    double rough = range / ticks;
+    double magnitude = pow(10, floor(log10(rough)));
+    double normalised = rough / magnitude;
+    if (normalised <= 1)
+        return magnitude;
+    if (normalised <= 2)
+        return 2 * magnitude;
+    if (normalised <= 5)
+        return 5 * magnitude;
+    return 10 * magnitude;
+}
+
+static string FormatNumber(double value) {
+    std::ostringstream text;
+    text << value;
+    return text.str();
+}
+
+// Draw one line chart with a log2 x axis of table sizes into the area at
+// (left, top), legend on the right
+//
+static void DrawLineChart(SvgWriter &svg, double left, double top, double width,
+                          double height, const string &title,
+                          const string &yLabel,
+                          const std::map<string, Points> &series) {
+    const double plotLeft = left + 60, plotTop = top + 40;
+    const double plotWidth = width - 60 - 150, plotHeight = height - 80;
+
+    double xMin = 1e300, xMax = -1e300, yMin = 1e300, yMax = -1e300;
+    for (std::map<string, Points>::const_iterator s = series.begin();
+         s != series.end(); ++s) {
+        for (size_t i = 0; i < s->second.size(); i++) {
+            xMin = std::min(xMin, log2(s->second[i].first));
+            xMax = std::max(xMax, log2(s->second[i].first));
+            yMin = std::min(yMin, s->second[i].second);
+            yMax = std::max(yMax, s->second[i].second);
+        }
+    }
+    if (xMax == xMin)
+        xMax = xMin + 1;
+    double yStep = NiceStep(std::max(yMax - yMin, fabs(yMax) * 1e-3 + 1e-9), 4);
+    yMin = floor(yMin / yStep) * yStep;
+    yMax = std::max(ceil(yMax / yStep) * yStep, yMin + yStep);
+
+    svg.Text(left + width / 2, top + 22, title, 15, "middle");
+    svg.Text(left + 16, plotTop + plotHeight / 2, yLabel, 12, "middle", "#222222", -90);
+    svg.Text(plotLeft + plotWidth / 2, plotTop + plotHeight + 36,
+             "Number of BP entries", 12, "middle");
+
+    for (double y = yMin; y <= yMax + yStep / 2; y += yStep) {
+        double py = plotTop + plotHeight - (y - yMin) / (yMax - yMin) * plotHeight;
+        svg.Line(plotLeft, py, plotLeft + plotWidth, py, "#cccccc");
+        svg.Text(plotLeft - 6, py + 4, FormatNumber(y), 11, "end", "#444444");
+    }
+    for (int x = (int)xMin; x <= (int)xMax; x++) {
+        double px = plotLeft + (x - xMin) / (xMax - xMin) * plotWidth;
+        svg.Line(px, plotTop, px, plotTop + plotHeight, "#cccccc");
+        svg.Text(px, plotTop + plotHeight + 16, FormatNumber(pow(2, x)), 11,
+                 "middle", "#444444");
+    }
+    svg.Line(plotLeft, plotTop + plotHeight, plotLeft + plotWidth,
+             plotTop + plotHeight, "#333333");
+
+    size_t colour = 0;
+    for (std::map<string, Points>::const_iterator s = series.begin();
+         s != series.end(); ++s, ++colour) {
+        const char *stroke = SERIES_COLOURS[colour % SERIES_COLOUR_COUNT];
+        Points points = s->second;
+        std::sort(points.begin(), points.end());
+        for (size_t i = 0; i < points.size(); i++) {
+            points[i].first =
+                plotLeft + (log2(points[i].first) - xMin) / (xMax - xMin) * plotWidth;
+            points[i].second = plotTop + plotHeight -
+                               (points[i].second - yMin) / (yMax - yMin) * plotHeight;
+            svg.Circle(points[i].first, points[i].second, 3, stroke);
+        }
+        svg.Polyline(points, stroke);
+
+        double legendY = plotTop + 10 + colour * 20;
+        svg.Line(plotLeft + plotWidth + 15, legendY - 4, plotLeft + plotWidth + 35,
+                 legendY - 4, stroke, 2);
+        svg.Text(plotLeft + plotWidth + 40, legendY, s->first, 11);
+    }
+}
+
+// Accuracy and MPKI of every configuration of one benchmark
+//
+static bool DrawBenchmark(const string &outdir, const string &benchmark,
+                          const std::vector<SweepResult> &results) {
+    std::map<string, Points> accuracy, mpki;
+    for (size_t i = 0; i < results.size(); i++) {
+        if (results[i].benchmark != benchmark)
+            continue;
+        accuracy[results[i].series].push_back(
+            std::make_pair(results[i].numberOfEntries, results[i].accuracy));
+        mpki[results[i].series].push_back(
+            std::make_pair(results[i].numberOfEntries, results[i].mpki));
+    }
+
+    string name = benchmark;
+    name[0] = toupper(name[0]);
+    SvgWriter svg(600, 600);
+    DrawLineChart(svg, 0, 0, 600, 300, "Benchmark " + name, "Prediction accuracy",
+                  accuracy);
+    DrawLineChart(svg, 0, 300, 600, 300, "Benchmark " + name, "MPKI", mpki);
+    return svg.Save(outdir + "/Benchmark_" + name + ".svg");
+}
+
+// Simulated million instructions per second of every configuration, one
+// group of bars per configuration and one bar per benchmark
+//
+static bool DrawSimulationSpeed(const string &outdir,
+                                const std::vector<string> &benchmarks,
+                                const std::vector<SweepResult> &results) {
+    std::vector<string> configs;
+    std::map<std::pair<string, string>, double> speed;
+    double maxSpeed = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        string config = results[i].series + " " + FormatNumber(results[i].numberOfEntries);
+        if (std::find(configs.begin(), configs.end(), config) == configs.end())
+            configs.push_back(config);
+        speed[std::make_pair(config, results[i].benchmark)] = results[i].mips;
+        maxSpeed = std::max(maxSpeed, results[i].mips);
+    }
+
+    const double plotLeft = 60, plotTop = 40, plotHeight = 220;
+    const double groupWidth = 18.0 * benchmarks.size() + 12;
+    const double plotWidth = std::max(300.0, groupWidth * configs.size());
+    SvgWriter svg(plotLeft + plotWidth + 150, plotTop + plotHeight + 130);
+
+    double yStep = NiceStep(std::max(maxSpeed, 1e-9), 4);
+    double yMax = std::max(ceil(maxSpeed / yStep) * yStep, yStep);
+    svg.Text(plotLeft + plotWidth / 2, 22, "Simulation speed", 15, "middle");
+    svg.Text(16, plotTop + plotHeight / 2, "Simulated MIPS", 12, "middle",
+             "#222222", -90);
+    for (double y = 0; y <= yMax + yStep / 2; y += yStep) {
+        double py = plotTop + plotHeight - y / yMax * plotHeight;
+        svg.Line(plotLeft, py, plotLeft + plotWidth, py, "#cccccc");
+        svg.Text(plotLeft - 6, py + 4, FormatNumber(y), 11, "end", "#444444");
+    }
+
+    for (size_t c = 0; c < configs.size(); c++) {
+        double groupLeft = plotLeft + c * groupWidth + 6;
+        for (size_t b = 0; b < benchmarks.size(); b++) {
+            double mips = speed[std::make_pair(configs[c], benchmarks[b])];
+            double barHeight = mips / yMax * plotHeight;
+            svg.Rect(groupLeft + b * 18, plotTop + plotHeight - barHeight, 16,
+                     barHeight, SERIES_COLOURS[b % SERIES_COLOUR_COUNT]);
+        }
+        double labelX = groupLeft + groupWidth / 2 - 6;
+        svg.Text(labelX, plotTop + plotHeight + 12, configs[c], 11, "end",
+                 "#444444", -45);
+    }
+    svg.Line(plotLeft, plotTop + plotHeight, plotLeft + plotWidth,
+             plotTop + plotHeight, "#333333");
+
+    for (size_t b = 0; b < benchmarks.size(); b++) {
+        double legendY = plotTop + 10 + b * 20;
+        svg.Rect(plotLeft + plotWidth + 15, legendY - 10, 12, 12,
+                 SERIES_COLOURS[b % SERIES_COLOUR_COUNT]);
+        svg.Text(plotLeft + plotWidth + 32, legendY, benchmarks[b], 11);
+    }
+    return svg.Save(outdir + "/Simulation_Speed.svg");
+}
+
+int main(int argc, char *argv[]) {
+    string outdir = ".";
+    std::vector<string> positional;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-d" && i + 1 < argc) {
+            outdir = argv[++i];
+        } else if (arg[0] == '-') {
+            return Usage();
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() != 1)
+        return Usage();
+
+    std::vector<SweepResult> results;
+    if (!ReadResults(positional[0], results))
+        return EXIT_FAILURE;
+
+    std::vector<string> benchmarks;
+    for (size_t i = 0; i < results.size(); i++) {
+        if (std::find(benchmarks.begin(), benchmarks.end(), results[i].benchmark) ==
+            benchmarks.end())
+            benchmarks.push_back(results[i].benchmark);
+    }
+    for (size_t b = 0; b < benchmarks.size(); b++) {
+        if (!DrawBenchmark(outdir, benchmarks[b], results)) {
+            cerr << "Error: cannot write the chart of " << benchmarks[b] << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (!results.empty() && !DrawSimulationSpeed(outdir, benchmarks, results)) {
+        cerr << "Error: cannot write the simulation speed chart" << endl;
+        return EXIT_FAILURE;
+    }
+    cerr << "Wrote charts of " << benchmarks.size() << " benchmarks to " << outdir
+         << endl;
+    return EXIT_SUCCESS;
+}
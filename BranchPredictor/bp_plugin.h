@@ -0,0 +1,73 @@
+#ifndef BP_PLUGIN_H
+#define BP_PLUGIN_H
+
+/* Stable C ABI of branch predictor plugins: shared objects that the pintool
+ * and bp_replay load with -bp_plugin <path.so>. A plugin exports
+ *
+ *   const struct bp_plugin *bp_plugin_get(void);
+ *
+ * which returns the function table of one predictor type. The type is then
+ * used by its name like a built-in one, as BP_type of the pintool, e.g.
+ * <name>:4096,param=value in a replay spec, or as a hybrid component. Only
+ * integers and pointers cross the ABI, so plugins can be built with any
+ * compiler and flags (-O3 -flto), independently of the Pin build. A plugin
+ * for the pintool must be linked against Pin CRT instead of the system C
+ * library, see the bp_plugin_gshare_pincrt rules in makefile.rules.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+/* Version of this table layout, checked when a plugin is loaded */
+#define BP_PLUGIN_ABI_VERSION 1
+
+/* Name of the function a plugin exports */
+#define BP_PLUGIN_ENTRY_POINT "bp_plugin_get"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The state of one predictor, defined by the plugin */
+typedef struct bp_predictor bp_predictor;
+
+struct bp_plugin {
+    uint32_t abi_version; /* BP_PLUGIN_ABI_VERSION */
+    const char *name;     /* predictor type name */
+
+    /* Create a predictor with entries table entries, or return NULL if the
+     * parameters are invalid. params is a comma separated, possibly empty,
+     * list of name=value pairs. */
+    bp_predictor *(*create)(uint64_t entries, const char *params);
+    void (*destroy)(bp_predictor *predictor);
+
+    /* Predict the branch at pc, nonzero for taken */
+    int (*predict)(bp_predictor *predictor, uint64_t pc);
+
+    /* Train on the outcome of the branch at pc, after predict() */
+    void (*update)(bp_predictor *predictor, uint64_t pc, int taken);
+
+    /* Optional, may be NULL. Predict and train on count branches in order,
+     * records[i] being (pc << 1) | taken, and store the prediction of every
+     * branch, made before training on it, in predictions[i]. */
+    void (*update_batch)(bp_predictor *predictor, const uint64_t *records,
+                         size_t count, uint8_t *predictions);
+
+    /* Bits of state the predictor would need in hardware */
+    uint64_t (*storage_bits)(bp_predictor *predictor);
+
+    /* Optional, may be NULL. Write the predictor state to buffer if size is
+     * large enough, and return the size of the state in bytes. */
+    size_t (*serialize)(bp_predictor *predictor, void *buffer, size_t size);
+
+    /* Optional, may be NULL. Restore a state written by serialize(),
+     * nonzero on success. */
+    int (*deserialize)(bp_predictor *predictor, const void *buffer, size_t size);
+};
+
+typedef const struct bp_plugin *(*bp_plugin_get_fn)(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BP_PLUGIN_H */
@@ -0,0 +1,158 @@
+/* Example predictor plugin: the gshare predictor of branch_predictors.h as a
+ * shared object implementing the C ABI of bp_plugin.h, with the same results.
+ * It takes the hist= and ctr= parameters.
+ *
+ *   make obj-intel64/bp_plugin_gshare.so TARGET=intel64 PIN_ROOT=$PIN_ROOT
+ *   obj-intel64/bp_replay.exe -bp_plugin obj-intel64/bp_plugin_gshare.so \
+ *       gobmk.bptrace gshare_plugin:4096,hist=10
+ *
+ * or, built against Pin CRT, in the pintool:
+ *
+ *   make obj-intel64/bp_plugin_gshare_pincrt.so TARGET=intel64 PIN_ROOT=$PIN_ROOT
+ *   pin -t obj-intel64/branch_predictor.so \
+ *       -bp_plugin obj-intel64/bp_plugin_gshare_pincrt.so \
+ *       -BP_type gshare_plugin -num_BP_entries 4096 -history_length 10 -- ...
+ */
+#include "bp_plugin.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct bp_predictor {
+    uint64_t entries;
+    uint64_t indexMask;
+    uint32_t indexBits;
+    uint32_t historyLength;
+    uint64_t historyMask;
+    uint64_t GHR;
+    uint8_t saturatorMax;
+    uint8_t *PHT;
+};
+
+static uint64_t LsbMask(uint32_t bits) {
+    return bits >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << bits) - 1;
+}
+
+static uint64_t GetIndex(const bp_predictor *p, uint64_t pc) {
+    uint64_t history = p->GHR & p->historyMask;
+    uint64_t folded = 0;
+    if (p->indexBits == 0)
+        return 0;
+    for (; history != 0; history = p->indexBits < 64 ? history >> p->indexBits : 0)
+        folded ^= history & p->indexMask;
+    return (pc ^ folded) & p->indexMask;
+}
+
+static bp_predictor *Create(uint64_t entries, const char *params) {
+    uint64_t historyLength = 0;
+    uint64_t counterBits = 2;
+    while (*params != '\0') {
+        const char *equals = strchr(params, '=');
+        char *end;
+        uint64_t value;
+        if (equals == NULL)
+            return NULL;
+        value = strtoull(equals + 1, &end, 0);
+        if (value == 0 || end == equals + 1 || (*end != '\0' && *end != ','))
+            return NULL;
+        if (equals - params == 4 && strncmp(params, "hist", 4) == 0 && value <= 64)
+            historyLength = value;
+        else if (equals - params == 3 && strncmp(params, "ctr", 3) == 0 && value <= 8)
+            counterBits = value;
+        else
+            return NULL;
+        params = *end ? end + 1 : end;
+    }
+    if (entries == 0)
+        return NULL;
+
+    bp_predictor *p = (bp_predictor *)calloc(1, sizeof(bp_predictor));
+    if (p == NULL)
+        return NULL;
+    p->entries = entries;
+    while (p->indexBits < 63 && ((uint64_t)2 << p->indexBits) <= entries)
+        p->indexBits++;
+    p->indexMask = LsbMask(p->indexBits);
+    p->historyLength = historyLength ? historyLength : p->indexBits;
+    p->historyMask = LsbMask(p->historyLength);
+    p->saturatorMax = LsbMask(counterBits);
+    p->PHT = (uint8_t *)malloc(entries);
+    if (p->PHT == NULL) {
+        free(p);
+        return NULL;
+    }
+    memset(p->PHT, p->saturatorMax, entries);
+    return p;
+}
+
+static void Destroy(bp_predictor *p) {
+    free(p->PHT);
+    free(p);
+}
+
+static int Predict(bp_predictor *p, uint64_t pc) {
+    return p->PHT[GetIndex(p, pc)] > p->saturatorMax / 2;
+}
+
+static void Update(bp_predictor *p, uint64_t pc, int taken) {
+    uint8_t *saturator = &p->PHT[GetIndex(p, pc)];
+    p->GHR = (p->GHR << 1) + (taken != 0);
+    if (taken && *saturator < p->saturatorMax)
+        (*saturator)++;
+    else if (!taken && *saturator > 0)
+        (*saturator)--;
+}
+
+static void UpdateBatch(bp_predictor *p, const uint64_t *records, size_t count,
+                        uint8_t *predictions) {
+    for (size_t i = 0; i < count; i++) {
+        uint64_t pc = records[i] >> 1;
+        int taken = records[i] & 1;
+        uint8_t *saturator = &p->PHT[GetIndex(p, pc)];
+        predictions[i] = *saturator > p->saturatorMax / 2;
+        p->GHR = (p->GHR << 1) + taken;
+        if (taken && *saturator < p->saturatorMax)
+            (*saturator)++;
+        else if (!taken && *saturator > 0)
+            (*saturator)--;
+    }
+}
+
+static uint64_t StorageBits(bp_predictor *p) {
+    uint32_t counterBits = 0;
+    while (((uint32_t)1 << counterBits) <= p->saturatorMax)
+        counterBits++;
+    return p->historyLength + p->entries * counterBits;
+}
+
+/* The state is the global history followed by the counters */
+static size_t Serialize(bp_predictor *p, void *buffer, size_t size) {
+    size_t stateSize = sizeof(p->GHR) + p->entries;
+    if (buffer != NULL && size >= stateSize) {
+        memcpy(buffer, &p->GHR, sizeof(p->GHR));
+        memcpy((char *)buffer + sizeof(p->GHR), p->PHT, p->entries);
+    }
+    return stateSize;
+}
+
+static int Deserialize(bp_predictor *p, const void *buffer, size_t size) {
+    if (size != sizeof(p->GHR) + p->entries)
+        return 0;
+    memcpy(&p->GHR, buffer, sizeof(p->GHR));
+    memcpy(p->PHT, (const char *)buffer + sizeof(p->GHR), p->entries);
+    return 1;
+}
+
+static const struct bp_plugin plugin = {
+    BP_PLUGIN_ABI_VERSION,
+    "gshare_plugin",
+    Create,
+    Destroy,
+    Predict,
+    Update,
+    UpdateBatch,
+    StorageBits,
+    Serialize,
+    Deserialize,
+};
+
+const struct bp_plugin *bp_plugin_get(void) { return &plugin; }
@@ -0,0 +1,208 @@
+// Offline replay of a trace captured with the pintool's -trace knob through
+// any number of predictor configurations in parallel.
+//
+// Usage: bp_replay [-threads N] [-chunk N] [-inflight N] [-lanes N] [-o file]
+//                  [-segments K [-warmup N] [-calibrate N]]
+//                  [-bp_plugin path.so]... <trace> <type:entries>...
+//
+// -bp_plugin loads a predictor plugin (see bp_plugin.h), whose type can then
+// be used in the specs like a built-in one.
+//
+// Gshare and bimodal configurations are replayed together in lane groups of
+// up to -lanes configurations (default 64, 0 replays each one on its own).
+//
+// With -segments, every predictor replays the trace as K segments in parallel,
+// each warmed up on the N branches before it. This is approximate; -calibrate
+// measures its error against an exact replay of the first N branches.
+//
+#include "trace_replay.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+using std::cerr;
+using std::endl;
+
+// Default number of branches decoded into one chunk
+//
+#define REPLAY_CHUNK_RECORDS (1 << 20)
+
+// Default number of chunks held in memory at the same time
+//
+#define REPLAY_INFLIGHT_CHUNKS 4
+
+// Default number of branches warming up each segment of a segmented replay
+//
+#define REPLAY_SEGMENT_WARMUP 1000000
+
+static int Usage() {
+    cerr << "This tool replays a captured branch trace through branch "
+            "predictors" << endl
+         << endl
+         << "Usage: bp_replay [-threads N] [-chunk N] [-inflight N] [-lanes N] [-o file] "
+            "[-segments K [-warmup N] [-calibrate N]] [-bp_plugin path.so]... "
+            "<trace> <type:entries>..."
+         << endl;
+    return -1;
+}
+
+static double Accuracy(const ReplayStats &stats) {
+    return (double)stats.correctPredictionCount /
+           (double)stats.conditionalBranchesCount;
+}
+
+// Compare a segmented replay of the first calibrationBranches branches with
+// an exact sequential replay of the same branches
+//
+static bool Calibrate(const std::string &tracePath,
+                      const std::vector<ReplayConfig> &configs,
+                      unsigned segments, UINT64 warmup, unsigned threads,
+                      UINT64 calibrationBranches) {
+    std::vector<ReplayConfig> exact(configs), segmented(configs);
+    for (size_t i = 0; i < configs.size(); i++)
+        exact[i].stats = segmented[i].stats = ReplayStats();
+
+    if (!SegmentedReplay(tracePath, 1, 0, threads).Run(exact, calibrationBranches) ||
+        !SegmentedReplay(tracePath, segments, warmup, threads)
+             .Run(segmented, calibrationBranches))
+        return false;
+
+    for (size_t i = 0; i < configs.size(); i++) {
+        double exactAccuracy = Accuracy(exact[i].stats);
+        double segmentedAccuracy = Accuracy(segmented[i].stats);
+        cerr << "Calibration of " << configs[i].spec << " on "
+             << calibrationBranches << " branches: exact accuracy "
+             << exactAccuracy << ", segmented accuracy " << segmentedAccuracy
+             << ", error " << segmentedAccuracy - exactAccuracy << endl;
+    }
+    return true;
+}
+
+static void PrintStats(std::ostream &out, const ReplayConfig &config,
+                       UINT64 instructionCount) {
+    const ReplayStats &stats = config.stats;
+    out << "Predictor:\t" << config.spec << endl
+        << "Prediction accuracy:\t" << Accuracy(stats) << endl
+        << "Number of conditional branches:\t" << stats.conditionalBranchesCount
+        << endl
+        << "Number of correct predictions:\t" << stats.correctPredictionCount
+        << endl
+        << "Number of taken branches:\t" << stats.takenBranchesCount << endl
+        << "Number of non-taken branches:\t" << stats.notTakenBranchesCount
+        << endl
+        << "Number of instructions:\t" << instructionCount << endl
+        << endl;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned threads = std::thread::hardware_concurrency();
+    size_t chunkRecords = REPLAY_CHUNK_RECORDS;
+    size_t inflightChunks = REPLAY_INFLIGHT_CHUNKS;
+    size_t maxLanes = REPLAY_MAX_LANES;
+    unsigned segments = 0;
+    UINT64 warmup = REPLAY_SEGMENT_WARMUP;
+    UINT64 calibrationBranches = 0;
+    std::string outputFile;
+    std::vector<std::string> pluginPaths;
+    std::vector<std::string> positional;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-threads" && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (arg == "-chunk" && i + 1 < argc) {
+            chunkRecords = strtoull(argv[++i], NULL, 0);
+        } else if (arg == "-inflight" && i + 1 < argc) {
+            inflightChunks = strtoull(argv[++i], NULL, 0);
+        } else if (arg == "-lanes" && i + 1 < argc) {
+            maxLanes = strtoull(argv[++i], NULL, 0);
+        } else if (arg == "-segments" && i + 1 < argc) {
+            segments = atoi(argv[++i]);
+        } else if (arg == "-warmup" && i + 1 < argc) {
+            warmup = strtoull(argv[++i], NULL, 0);
+        } else if (arg == "-calibrate" && i + 1 < argc) {
+            calibrationBranches = strtoull(argv[++i], NULL, 0);
+        } else if (arg == "-o" && i + 1 < argc) {
+            outputFile = argv[++i];
+        } else if (arg == "-bp_plugin" && i + 1 < argc) {
+            pluginPaths.push_back(argv[++i]);
+        } else if (arg[0] == '-') {
+            return Usage();
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() < 2 || threads == 0 || chunkRecords == 0 ||
+        inflightChunks == 0)
+        return Usage();
+
+    for (size_t i = 0; i < pluginPaths.size(); i++) {
+        std::string error;
+        if (!LoadBranchPredictorPlugin(pluginPaths[i], error)) {
+            cerr << "Error: cannot load predictor plugin: " << error << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    BranchTraceReader reader;
+    if (!reader.Open(positional[0])) {
+        cerr << "Error: cannot read trace file " << positional[0] << endl;
+        return EXIT_FAILURE;
+    }
+    if (reader.BranchCount() == 0) {
+        cerr << "Error: trace file " << positional[0] << " has no branches" << endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<ReplayConfig> configs(positional.size() - 1);
+    for (size_t i = 0; i < configs.size(); i++) {
+        configs[i].spec = positional[i + 1];
+        configs[i].predictor = CreatePredictorFromSpec(configs[i].spec);
+        if (configs[i].predictor == NULL) {
+            cerr << "Error: No such branch predictor, or a parameter it does not "
+                    "take, in " << configs[i].spec << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    cerr << "Replaying " << reader.BranchCount() << " branches through "
+         << configs.size() << " predictors." << endl;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool failed;
+    if (segments == 0) {
+        ParallelReplay replay(chunkRecords, inflightChunks, threads, maxLanes);
+        replay.Run(reader, configs);
+        failed = reader.Failed();
+    } else {
+        if (calibrationBranches > 0) {
+            calibrationBranches = std::min(calibrationBranches, reader.BranchCount());
+            if (!Calibrate(positional[0], configs, segments, warmup, threads,
+                           calibrationBranches))
+                return EXIT_FAILURE;
+            start = std::chrono::steady_clock::now();
+        }
+        SegmentedReplay replay(positional[0], segments, warmup, threads);
+        failed = !replay.Run(configs, reader.BranchCount());
+    }
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start).count();
+    if (failed) {
+        cerr << "Error: trace file " << positional[0] << " is corrupt" << endl;
+        return EXIT_FAILURE;
+    }
+
+    std::ofstream outFile;
+    if (!outputFile.empty())
+        outFile.open(outputFile.c_str());
+    std::ostream &out = outputFile.empty() ? std::cout : outFile;
+    for (size_t i = 0; i < configs.size(); i++) {
+        PrintStats(out, configs[i], reader.InstructionCount());
+        delete configs[i].predictor;
+    }
+
+    cerr << "Replay took " << seconds << " s, "
+         << reader.BranchCount() * configs.size() / seconds / 1e6
+         << " million predictions/s." << endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,388 @@
+// Search the parameters of branch predictors for the most accurate design that
+// fits a storage budget, by coordinate descent over table size, history
+// length, counter width, local history table size and chooser size, replaying
+// a captured trace offline.
+//
+// Usage: bp_search [-threads N] [-budget KB] [-prefix N] [-margin X]
+//                  [-rounds N] [-o file] <trace> <type>...
+//
+// Every step evaluates all values of one parameter in parallel. Candidates
+// first replay the first N branches of the trace, and those whose accuracy is
+// then more than X below the best one are dropped without replaying the rest.
+//
+#include "trace_replay.h"
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+using std::cerr;
+using std::endl;
+using std::string;
+
+// Default storage budget in KB
+//
+#define SEARCH_BUDGET_KB 8
+
+// Default number of branches replayed before dropping clearly worse candidates
+//
+#define SEARCH_PREFIX_BRANCHES 2000000
+
+// Default accuracy margin below the best candidate after the prefix
+//
+#define SEARCH_MARGIN 0.005
+
+// Default maximum number of passes over all parameters
+//
+#define SEARCH_ROUNDS 4
+
+// Longest history searched, in bits
+//
+#define SEARCH_MAX_HISTORY 32
+
+// Parameters searched, as indices into SearchDesign::values
+//
+enum SearchParam {
+    PARAM_ENTRIES,  // log2 of the number of entries
+    PARAM_HISTORY,  // history length
+    PARAM_COUNTER,  // counter width
+    PARAM_LHR,      // log2 of the number of local history registers
+    PARAM_CHOOSER,  // log2 of the number of chooser entries
+    PARAM_COUNT
+};
+
+static const char *const PARAM_NAMES[PARAM_COUNT] = {"entries", "hist", "ctr",
+                                                     "lhr", "chooser"};
+static const int PARAM_MIN[PARAM_COUNT] = {1, 1, 1, 0, 1};
+static const int PARAM_MAX[PARAM_COUNT] = {24, SEARCH_MAX_HISTORY, 4, 16, 24};
+
+struct SearchDesign {
+    string type;
+    int values[PARAM_COUNT];
+};
+
+// Outcome of replaying one candidate, complete unless it was dropped after
+// the prefix
+//
+struct SearchResult {
+    UINT64 storageBits;
+    ReplayStats prefixStats;
+    ReplayStats stats;
+    bool complete;
+};
+
+static int Usage() {
+    cerr << "This tool searches predictor parameters under a storage budget"
+         << endl
+         << endl
+         << "Usage: bp_search [-threads N] [-budget KB] [-prefix N] "
+            "[-margin X] [-rounds N] [-o file] <trace> <type>..."
+         << endl;
+    return -1;
+}
+
+static double Accuracy(const ReplayStats &stats) {
+    return (double)stats.correctPredictionCount /
+           (double)stats.conditionalBranchesCount;
+}
+
+// Return whether the predictor type has the parameter
+//
+static bool HasParam(const string &type, int param) {
+    static const UINT32 PARAM_BITS[PARAM_COUNT] = {
+        0, PREDICTOR_PARAM_HIST, PREDICTOR_PARAM_CTR, PREDICTOR_PARAM_LHR,
+        PREDICTOR_PARAM_CHOOSER};
+    const BranchPredictorType *predictorType = FindBranchPredictorType(type);
+    if (predictorType == NULL)
+        return false;
+    if (param == PARAM_ENTRIES)
+        return type != "always_taken";
+    return (predictorType->params & PARAM_BITS[param]) != 0;
+}
+
+static string DesignSpec(const SearchDesign &design) {
+    std::ostringstream spec;
+    spec << design.type << ":";
+    if (HasParam(design.type, PARAM_ENTRIES))
+        spec << (1ULL << design.values[PARAM_ENTRIES]);
+    else
+        spec << 1;
+    for (int param = PARAM_HISTORY; param < PARAM_COUNT; param++) {
+        if (!HasParam(design.type, param))
+            continue;
+        int value = design.values[param];
+        if (param == PARAM_LHR || param == PARAM_CHOOSER)
+            spec << "," << PARAM_NAMES[param] << "=" << (1ULL << value);
+        else
+            spec << "," << PARAM_NAMES[param] << "=" << value;
+    }
+    return spec.str();
+}
+
+// The predictor's default design with the largest table that fits the budget
+//
+static bool InitialDesign(const string &type, UINT64 budgetBits,
+                          SearchDesign &design) {
+    design.type = type;
+    for (int entries = PARAM_MAX[PARAM_ENTRIES];
+         entries >= PARAM_MIN[PARAM_ENTRIES]; entries--) {
+        design.values[PARAM_ENTRIES] = entries;
+        design.values[PARAM_HISTORY] = std::min(entries, SEARCH_MAX_HISTORY);
+        design.values[PARAM_COUNTER] = 2;
+        design.values[PARAM_LHR] = 7;
+        design.values[PARAM_CHOOSER] = entries;
+        BranchPredictorInterface *predictor = CreatePredictorFromSpec(DesignSpec(design));
+        if (predictor == NULL)
+            return false;
+        UINT64 storageBits = predictor->getStorageBits();
+        delete predictor;
+        if (storageBits <= budgetBits)
+            return true;
+    }
+    return false;
+}
+
+class DesignSearch {
+  private:
+    string tracePath;
+    UINT64 branchCount;
+    unsigned threadCount;
+    UINT64 budgetBits;
+    UINT64 prefixBranches;
+    double margin;
+
+    std::map<string, SearchResult> results;
+
+    struct Candidate {
+        string spec;
+        BranchPredictorInterface *predictor;
+        ReplayStats stats;
+        bool failed;
+    };
+
+    bool Replay(Candidate &candidate, UINT64 first, UINT64 count) {
+        BranchTraceReader reader;
+        return reader.Open(tracePath) &&
+               ReplayRange(reader, candidate.predictor, first, count,
+                           candidate.stats);
+    }
+
+  public:
+    bool failed;
+
+    DesignSearch(const string &tracePath, UINT64 branchCount, unsigned threads,
+                 UINT64 budgetBits, UINT64 prefixBranches, double margin)
+        : tracePath(tracePath), branchCount(branchCount), threadCount(threads),
+          budgetBits(budgetBits),
+          prefixBranches(std::min(prefixBranches, branchCount)), margin(margin),
+          failed(false) {}
+
+    const SearchResult *Find(const string &spec) const {
+        std::map<string, SearchResult>::const_iterator it = results.find(spec);
+        return it == results.end() ? NULL : &it->second;
+    }
+
+    size_t EvaluatedCount() const { return results.size(); }
+
+    size_t StoppedEarlyCount() const {
+        size_t count = 0;
+        std::map<string, SearchResult>::const_iterator it;
+        for (it = results.begin(); it != results.end(); ++it)
+            count += !it->second.complete;
+        return count;
+    }
+
+    // Replay the designs not evaluated yet that fit the budget, against the
+    // prefix accuracy of the best design so far
+    void Evaluate(const std::vector<SearchDesign> &designs, const string &bestSpec) {
+        std::vector<Candidate> candidates;
+        for (size_t i = 0; i < designs.size(); i++) {
+            Candidate candidate;
+            candidate.spec = DesignSpec(designs[i]);
+            if (results.count(candidate.spec))
+                continue;
+            candidate.predictor = CreatePredictorFromSpec(candidate.spec);
+            if (candidate.predictor == NULL)
+                continue;
+            if (candidate.predictor->getStorageBits() > budgetBits) {
+                delete candidate.predictor;
+                continue;
+            }
+            candidate.failed = false;
+            candidates.push_back(candidate);
+        }
+
+        ParallelFor(candidates.size(), threadCount, [&](size_t i) {
+            candidates[i].failed = !Replay(candidates[i], 0, prefixBranches);
+        });
+
+        double bestPrefixAccuracy = 0;
+        const SearchResult *best = Find(bestSpec);
+        if (best != NULL)
+            bestPrefixAccuracy = Accuracy(best->prefixStats);
+        for (size_t i = 0; i < candidates.size(); i++)
+            bestPrefixAccuracy = std::max(bestPrefixAccuracy,
+                                          Accuracy(candidates[i].stats));
+
+        std::vector<SearchResult> candidateResults(candidates.size());
+        for (size_t i = 0; i < candidates.size(); i++) {
+            candidateResults[i].storageBits = candidates[i].predictor->getStorageBits();
+            candidateResults[i].prefixStats = candidates[i].stats;
+            candidateResults[i].complete =
+                Accuracy(candidates[i].stats) >= bestPrefixAccuracy - margin;
+        }
+
+        ParallelFor(candidates.size(), threadCount, [&](size_t i) {
+            if (candidateResults[i].complete && !candidates[i].failed)
+                candidates[i].failed = !Replay(candidates[i], prefixBranches,
+                                               branchCount - prefixBranches);
+        });
+
+        for (size_t i = 0; i < candidates.size(); i++) {
+            failed |= candidates[i].failed;
+            candidateResults[i].stats = candidates[i].stats;
+            results[candidates[i].spec] = candidateResults[i];
+            delete candidates[i].predictor;
+        }
+    }
+
+    // Return whether the complete result a beats the complete result b: more
+    // correct predictions, then less storage
+    static bool Better(const SearchResult &a, const SearchResult &b) {
+        if (a.stats.correctPredictionCount != b.stats.correctPredictionCount)
+            return a.stats.correctPredictionCount > b.stats.correctPredictionCount;
+        return a.storageBits < b.storageBits;
+    }
+
+    // Coordinate descent from the default design of design.type, returns
+    // false if no design fits the budget
+    bool Run(SearchDesign &design, unsigned rounds) {
+        if (!InitialDesign(design.type, budgetBits, design))
+            return false;
+        string bestSpec = DesignSpec(design);
+        Evaluate(std::vector<SearchDesign>(1, design), bestSpec);
+        if (Find(bestSpec) == NULL)
+            return false;
+
+        for (unsigned round = 0; round < rounds && !failed; round++) {
+            bool improved = false;
+            for (int param = 0; param < PARAM_COUNT; param++) {
+                if (!HasParam(design.type, param))
+                    continue;
+
+                std::vector<SearchDesign> neighbours;
+                for (int value = PARAM_MIN[param]; value <= PARAM_MAX[param]; value++) {
+                    SearchDesign neighbour = design;
+                    neighbour.values[param] = value;
+                    neighbours.push_back(neighbour);
+                }
+                Evaluate(neighbours, bestSpec);
+
+                for (size_t i = 0; i < neighbours.size(); i++) {
+                    const SearchResult *result = Find(DesignSpec(neighbours[i]));
+                    if (result != NULL && result->complete &&
+                        Better(*result, *Find(bestSpec))) {
+                        design = neighbours[i];
+                        bestSpec = DesignSpec(design);
+                        improved = true;
+                    }
+                }
+            }
+            cerr << "Round " << round + 1 << ": " << bestSpec << " accuracy "
+                 << Accuracy(Find(bestSpec)->stats) << endl;
+            if (!improved)
+                break;
+        }
+        return true;
+    }
+};
+
+int main(int argc, char *argv[]) {
+    unsigned threads = std::thread::hardware_concurrency();
+    double budgetKB = SEARCH_BUDGET_KB;
+    UINT64 prefixBranches = SEARCH_PREFIX_BRANCHES;
+    double margin = SEARCH_MARGIN;
+    unsigned rounds = SEARCH_ROUNDS;
+    string outputFile;
+    std::vector<string> positional;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-threads" && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (arg == "-budget" && i + 1 < argc) {
+            budgetKB = atof(argv[++i]);
+        } else if (arg == "-prefix" && i + 1 < argc) {
+            prefixBranches = strtoull(argv[++i], NULL, 0);
+        } else if (arg == "-margin" && i + 1 < argc) {
+            margin = atof(argv[++i]);
+        } else if (arg == "-rounds" && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+        } else if (arg == "-o" && i + 1 < argc) {
+            outputFile = argv[++i];
+        } else if (arg[0] == '-') {
+            return Usage();
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() < 2 || threads == 0 || budgetKB <= 0)
+        return Usage();
+
+    BranchTraceReader reader;
+    if (!reader.Open(positional[0])) {
+        cerr << "Error: cannot read trace file " << positional[0] << endl;
+        return EXIT_FAILURE;
+    }
+    if (reader.BranchCount() == 0) {
+        cerr << "Error: trace file " << positional[0] << " has no branches" << endl;
+        return EXIT_FAILURE;
+    }
+
+    std::ofstream outFile;
+    if (!outputFile.empty())
+        outFile.open(outputFile.c_str());
+    std::ostream &out = outputFile.empty() ? std::cout : outFile;
+
+    UINT64 budgetBits = budgetKB * 8192;
+    for (size_t i = 1; i < positional.size(); i++) {
+        DesignSearch search(positional[0], reader.BranchCount(), threads,
+                            budgetBits, prefixBranches, margin);
+        SearchDesign design;
+        design.type = positional[i];
+        BranchPredictorInterface *predictor = CreateBranchPredictor(design.type, 1);
+        if (predictor == NULL) {
+            cerr << "Error: No such branch predictor " << design.type << endl;
+            return EXIT_FAILURE;
+        }
+        delete predictor;
+
+        cerr << "Searching " << design.type << " designs within " << budgetKB
+             << " KB." << endl;
+        bool found = search.Run(design, rounds);
+        if (search.failed) {
+            cerr << "Error: trace file " << positional[0] << " is corrupt" << endl;
+            return EXIT_FAILURE;
+        }
+        if (!found) {
+            cerr << "Error: No " << design.type << " branch predictor fits in "
+                 << budgetKB << " KB" << endl;
+            return EXIT_FAILURE;
+        }
+
+        const SearchResult &best = *search.Find(DesignSpec(design));
+        out << "Predictor:\t" << DesignSpec(design) << endl
+            << "Storage (KB):\t" << best.storageBits / 8192.0 << endl
+            << "Prediction accuracy:\t" << Accuracy(best.stats) << endl
+            << "MPKI:\t"
+            << 1000.0 *
+                   (best.stats.conditionalBranchesCount -
+                    best.stats.correctPredictionCount) /
+                   reader.InstructionCount()
+            << endl
+            << "Designs evaluated:\t" << search.EvaluatedCount() << endl
+            << "Designs stopped early:\t" << search.StoppedEarlyCount() << endl
+            << endl;
+    }
+    return EXIT_SUCCESS;
+}
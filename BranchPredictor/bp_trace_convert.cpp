@@ -0,0 +1,68 @@
+// Convert a captured branch trace between the raw and compressed formats.
+//
+// Usage: bp_trace_convert [-format raw|compressed] <input trace> <output trace>
+//
+#include "branch_trace.h"
+#include <iostream>
+
+using std::cerr;
+using std::endl;
+
+static int Usage() {
+    cerr << "This tool converts branch traces between the raw and compressed "
+            "formats" << endl
+         << endl
+         << "Usage: bp_trace_convert [-format raw|compressed] <input trace> "
+            "<output trace>" << endl;
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    std::string format = "compressed";
+    std::vector<std::string> positional;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-format" && i + 1 < argc) {
+            format = argv[++i];
+        } else if (arg[0] == '-') {
+            return Usage();
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() != 2 || (format != "raw" && format != "compressed"))
+        return Usage();
+
+    BranchTraceReader reader;
+    if (!reader.Open(positional[0])) {
+        cerr << "Error: cannot read trace file " << positional[0] << endl;
+        return EXIT_FAILURE;
+    }
+    BranchTraceWriter writer;
+    if (!writer.Open(positional[1], format == "compressed")) {
+        cerr << "Error: cannot open trace file " << positional[1] << endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<UINT64> buffer;
+    for (;;) {
+        size_t count = COMPRESSED_TRACE_BLOCK_BRANCHES;
+        const UINT64 *records = reader.Next(buffer, count);
+        if (count == 0)
+            break;
+        for (size_t i = 0; i < count; i++)
+            writer.Append(BranchRecordPC(records[i]), BranchRecordTaken(records[i]));
+    }
+    bool written = writer.Close(reader.InstructionCount());
+
+    if (reader.Failed()) {
+        cerr << "Error: trace file " << positional[0] << " is corrupt" << endl;
+        return EXIT_FAILURE;
+    }
+    if (!written) {
+        cerr << "Error: cannot write trace file " << positional[1] << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -1,9 +1,13 @@
 #include "pin.H"
+#include <sys/time.h>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
-#include <math.h>
-#include <bitset>
+#include <map>
+#include "branch_predictors.h"
+#include "branch_profile.h"
+#include "branch_stats.h"
+#include "branch_trace.h"
 
 using std::cerr;
 using std::endl;
@@ -22,311 +26,609 @@ using std::string;
 #define STOP_INSTR_NUM 1000000000 // 1b instrs
 
 
-std::bitset<2> saturatorStrengthen(std::bitset<2> saturator ) {
-    if (saturator.to_ulong() < 3) 
-        return saturator.to_ulong() + 1;
-    else return saturator;
-}
+// Branches executed fewer times than this are left out of the ranking by
+// misprediction rate
+//
+#define BRANCH_STATS_MIN_EXECUTIONS 1000
 
-std::bitset<2> saturatorWeaken(std::bitset<2> saturator ) {
-    if (saturator.to_ulong() > 0) // strengthen local
-        return saturator.to_ulong() - 1; 
-    else return saturator;
-}
 
-/* Base branch predictor class */
-// You are highly recommended to follow this design when implementing your
-// branch predictors
+// Default interval length of the branch profiles
 //
-class BranchPredictorInterface {
-  public:
-    // This function returns a prediction for a branch instruction with address
-    // branchPC
-    virtual bool getPrediction(ADDRINT branchPC) = 0;
+#define PROFILE_INTERVAL_INSTR 10000000 // 10m instrs
 
-    // This function updates branch predictor's history with outcome of branch
-    // instruction with address branchPC
-    virtual void train(ADDRINT branchPC, bool branchWasTaken) = 0;
-};
 
-// This is a class which implements always taken branch predictor
-class AlwaysTakenBranchPredictor : public BranchPredictorInterface {
-  public:
-    AlwaysTakenBranchPredictor(
-        UINT64 numberOfEntries){}; // no entries here: always taken branch
-                                   // predictor is the simplest predictor
-    virtual bool getPrediction(ADDRINT branchPC) {
-        return true; // predict taken
-    }
-    virtual void train(ADDRINT branchPC, bool branchWasTaken) {
-    } // nothing to do here: always taken branch predictor does not have history
-};
+// A branch that failed to switch to bulk counting is checked again after
+// twice as many executions, up to this many
+//
+#define BIAS_MAX_THRESHOLD (1 << 20)
 
 
-class LocalBranchPredictor : public BranchPredictorInterface {
-  private:
-	std::vector<ADDRINT> LHR; 
-	std::vector<std::bitset<2>> PHT; 
-    ADDRINT lhrEntryLength;
-    ADDRINT lhrLsbMask;
+ofstream OutFile;
+ofstream IntervalFile;
+BranchPredictorInterface *branchPredictor;
+BranchTraceWriter traceWriter;
+BranchStatsTable branchStats;
+bool edgeInstrumentation = false;
 
-    int GetLhrIndex(ADDRINT branchPC){
-        ADDRINT lhrIndex = branchPC & 0b1111111;
-        return lhrIndex;
-    }
+// Static conditional branches get dense IDs, in the order they are first
+// instrumented, which index the per-branch arrays of the analysis routines
+//
+std::map<ADDRINT, UINT32> staticBranchIds;
 
-    int GetPhtIndex(ADDRINT branchPC){
-        ADDRINT lhrIndex = GetLhrIndex(branchPC);
-        ADDRINT phtIndex = LHR[lhrIndex] & lhrLsbMask;
-        return phtIndex;
-    }
+// Address ranges of the images loaded so far, kept for symbolizing branches
+// after their image is unloaded
+//
+struct LoadedImage {
+    ADDRINT low;
+    ADDRINT high;
+    string name;
+};
+std::vector<LoadedImage> loadedImages;
 
-  public:
-    LocalBranchPredictor(ADDRINT numberOfEntries){
-        LHR = std::vector<ADDRINT>(128);
-		PHT = std::vector<std::bitset<2>>(numberOfEntries);
+// Define the command line arguments that Pin should accept for this tool
+//
+KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "BP_stats.out",
+                            "specify output file name");
+KNOB<UINT64> KnobNumberOfEntriesInBranchPredictor(
+    KNOB_MODE_WRITEONCE, "pintool", "num_BP_entries", "1024",
+    "specify number of entries in a branch predictor");
+KNOB<string>
+    KnobBranchPredictorType(KNOB_MODE_WRITEONCE, "pintool", "BP_type",
+                            "always_taken",
+                            "specify type of branch predictor to be used, "
+                            "or a hybrid(...) spec");
+KNOB<UINT32> KnobHistoryLength(KNOB_MODE_WRITEONCE, "pintool", "history_length",
+                               "0",
+                               "specify history length in bits, 0 for "
+                               "log2(num_BP_entries)");
+KNOB<UINT32> KnobCounterBits(KNOB_MODE_WRITEONCE, "pintool", "counter_bits", "0",
+                             "specify saturating counter width, 0 for 2");
+KNOB<UINT64> KnobLocalHistoryEntries(KNOB_MODE_WRITEONCE, "pintool",
+                                     "lhr_entries", "0",
+                                     "specify number of local history "
+                                     "registers, 0 for 128");
+KNOB<UINT64> KnobChooserEntries(KNOB_MODE_WRITEONCE, "pintool",
+                                "chooser_entries", "0",
+                                "specify number of tournament chooser, "
+                                "2bc_gskew meta, bi_mode and yags choice or "
+                                "agree bias entries, 0 for num_BP_entries");
+KNOB<string> KnobPlugin(KNOB_MODE_APPEND, "pintool", "bp_plugin", "",
+                        "load a predictor plugin shared object, whose type "
+                        "can then be used as BP_type");
+KNOB<UINT32> KnobTopBranches(KNOB_MODE_WRITEONCE, "pintool", "top_branches",
+                             "0",
+                             "report this many hardest static branches, 0 "
+                             "disables per-branch statistics");
+KNOB<UINT64> KnobBranchStatsEntries(KNOB_MODE_WRITEONCE, "pintool",
+                                    "branch_stats_entries", "65536",
+                                    "specify number of static branches the "
+                                    "per-branch statistics and bias tracking "
+                                    "are preallocated for");
+KNOB<string> KnobBranchInstrumentation(KNOB_MODE_WRITEONCE, "pintool",
+                                        "branch_instrumentation", "before",
+                                        "specify how conditional branches are "
+                                        "instrumented: before (one call that "
+                                        "reads the outcome) or edge (one call "
+                                        "per outcome)");
+KNOB<BOOL> KnobFastPath(KNOB_MODE_WRITEONCE, "pintool", "fast_path", "0",
+                         "simulate gshare and bimodal with inlinable "
+                         "analysis routines, needs -top_branches 0 and no "
+                         "-trace");
+KNOB<UINT32> KnobBiasThreshold(KNOB_MODE_WRITEONCE, "pintool", "bias_threshold",
+                               "0",
+                               "count a static branch in bulk, with an inlined "
+                               "counter, after this many consecutive "
+                               "executions with the same outcome, 0 disables");
+KNOB<string> KnobProfileRecord(KNOB_MODE_WRITEONCE, "pintool", "profile_record",
+                               "",
+                               "only profile the conditional branches, without "
+                               "simulating a predictor, into this file");
+KNOB<string> KnobProfileUse(KNOB_MODE_WRITEONCE, "pintool", "profile_use", "",
+                            "use the branch profile in this file: count the "
+                            "branches it shows fully biased in bulk and size "
+                            "the per-branch tables");
+KNOB<UINT64> KnobWindowLength(KNOB_MODE_WRITEONCE, "pintool", "window_length",
+                              "0",
+                              "only simulate this many instructions, from "
+                              "where the -profile_use profile shows a "
+                              "representative branch density, 0 simulates "
+                              "the whole run");
+KNOB<string> KnobStatsFormat(KNOB_MODE_WRITEONCE, "pintool", "stats_format",
+                             "text",
+                             "specify output file format: text or json");
+KNOB<UINT64> KnobInterval(KNOB_MODE_WRITEONCE, "pintool", "interval", "0",
+                          "write accuracy and MPKI every this many "
+                          "instructions, 0 disables interval output");
+KNOB<string> KnobIntervalFile(KNOB_MODE_WRITEONCE, "pintool", "interval_file",
+                              "",
+                              "specify interval CSV file name, default is the "
+                              "output file name with .intervals.csv appended");
+KNOB<string> KnobTraceFile(KNOB_MODE_WRITEONCE, "pintool", "trace", "",
+                           "capture the conditional branches into this trace "
+                           "file for offline replay");
+KNOB<string> KnobTraceFormat(KNOB_MODE_WRITEONCE, "pintool", "trace_format",
+                             "compressed",
+                             "specify trace format: raw or compressed");
 
-        for (ADDRINT i = 0; i < LHR.size(); i += 1) {
-            LHR[i] = 0;
-        }
+// The running counts of branches, predictions and instructions are kept here
+//
+static UINT64 iCount = 0;
+static UINT64 correctPredictionCount = 0;
+static UINT64 conditionalBranchesCount = 0;
+static UINT64 takenBranchesCount = 0;
+static UINT64 notTakenBranchesCount = 0;
+static UINT64 predictedTakenBranchesCount = 0;
+static UINT64 predictedNotTakenBranchesCount = 0;
 
-        lhrLsbMask = 0;
-        lhrEntryLength = log2(numberOfEntries);
-        for (ADDRINT i = 0; i < lhrEntryLength; i += 1) {
-            lhrLsbMask = lhrLsbMask << 1;
-            lhrLsbMask = lhrLsbMask | 0b1;
-        }
+// Wall clock time at which the simulation started
+//
+static double simulationStartTime = 0;
 
-        for (ADDRINT i = 0; i < PHT.size(); i += 1) {
-            PHT[i] = 0b11;
-        }
-    }; 
-
-    virtual bool getPrediction(ADDRINT branchPC) { 
-        // PHT[LHR[branchPC]]
-        std::bitset<2> saturator = PHT[GetPhtIndex(branchPC)];
-        return saturator[1];
-    } 
-
-    virtual void train(ADDRINT branchPC, bool branchWasTaken) {
-        
-        ADDRINT lhrIndex = GetLhrIndex(branchPC);
-        ADDRINT phtIndex = GetPhtIndex(branchPC);
-
-        // update local history
-        LHR[lhrIndex] = LHR[lhrIndex] << 1;
-        LHR[lhrIndex] += branchWasTaken;
-
-        // update saturator
-        std::bitset<2> saturator = PHT[phtIndex];
-        if (branchWasTaken) { // strengthen
-            PHT[phtIndex] = saturatorStrengthen(saturator); 
-        } else { // weaken
-            PHT[phtIndex] = saturatorWeaken(saturator); 
-        }
+// The counters at the start of the current interval
+//
+static UINT64 intervalLength = 0;
+static UINT64 nextIntervalEnd = 0;
+static UINT64 intervalNumber = 0;
+static UINT64 intervalStartICount = 0;
+static UINT64 intervalStartBranches = 0;
+static UINT64 intervalStartCorrect = 0;
+static UINT64 intervalStartTaken = 0;
+
+// Instructions are counted by an inlined If routine, and docount() only runs
+// as its Then routine when the next heartbeat, interval end or stop is reached
+//
+static UINT64 nextCheckpoint = 0;
 
-    } 
+// With -fast_path, gshare and bimodal are simulated on these plain globals by
+// analysis routines Pin can inline, instead of through branchPredictor. A
+// bimodal predictor is a gshare predictor without history.
+//
+static bool fastPath = false;
+static UINT8 *fastPHT = NULL;
+static UINT64 fastGHR = 0;
+static UINT64 fastHistoryMask = 0;
+static ADDRINT fastIndexMask = 0;
+static UINT32 fastCounterThreshold = 0;  // counters above it predict taken
+static UINT8 fastNextCounter[2][256];    // counter after a not-taken/taken outcome
+
+// With -bias_threshold N, a static branch that resolved the same way N times
+// in a row, while the predictor is steady for it, is re-instrumented with an
+// inlined counter, and its executions are added to the counters in bulk. It
+// goes back to full simulation when it resolves the other way, or when another
+// static branch with the same static key is instrumented.
+//
+#define BULK_NONE 2          // bulkOutcome of the branches simulated one by one
+#define KEY_SHARED 0xFFFFFFFF // staticKeyOwners value of keys of several branches
+
+struct BiasedBranch {
+    UINT64 bulkExecutions; // executions counted but not added to the counters
+    UINT32 runLength;      // consecutive executions with runOutcome
+    UINT8 runOutcome;
+    UINT8 bulkOutcome;     // outcome counted in bulk, or BULK_NONE
+    UINT8 bulkPrediction;  // prediction of every execution counted in bulk
+    UINT32 threshold;      // runLength switching to bulk counting, 0 for never
+    UINT8 sharedKey;       // another static branch has the same static key
+    UINT8 listed;          // in bulkBranchIds
+    UINT8 reinstrument;    // bulk counting stopped, remove its instrumentation
 };
-
-class GshareBranchPredictor : public BranchPredictorInterface {
-  private:
-	ADDRINT GHR; 
-	std::vector<std::bitset<2>> PHT; 
-    ADDRINT ghrEntryLength;
-    ADDRINT lsbMask;
-
-    int GetPCLsb(ADDRINT branchPC){
-        ADDRINT pclsb = branchPC & lsbMask;
-        return pclsb;
+static bool biasTracking = false;
+static UINT32 biasThreshold = 0;
+static std::vector<BiasedBranch> biasedBranches;  // indexed by branch ID
+static std::vector<UINT32> bulkBranchIds;         // branches ever counted in bulk
+static std::map<ADDRINT, UINT32> staticKeyOwners; // static key to branch ID
+static UINT64 bulkExecutionsCount = 0;
+
+// Add the executions counted in bulk of a branch to the counters
+//
+static VOID FlushBulkCounts(UINT32 branchId) {
+    BiasedBranch &branch = biasedBranches[branchId];
+    UINT64 count = branch.bulkExecutions;
+    bool branchWasTaken = branch.bulkOutcome;
+    bool wasPredictedTaken = branch.bulkPrediction;
+    branch.bulkExecutions = 0;
+
+    bulkExecutionsCount += count;
+    conditionalBranchesCount += count;
+    if (wasPredictedTaken) {
+        predictedTakenBranchesCount += count;
+    } else {
+        predictedNotTakenBranchesCount += count;
+    }
+    if (branchWasTaken) {
+        takenBranchesCount += count;
+    } else {
+        notTakenBranchesCount += count;
     }
+    if (wasPredictedTaken == branchWasTaken)
+        correctPredictionCount += count;
+    if (branchStats.IsEnabled())
+        branchStats.RecordBulk(branchId, branchWasTaken,
+                               wasPredictedTaken != branchWasTaken, count);
+}
 
-    int GetPhtIndex(ADDRINT branchPC){
-        ADDRINT pclsb = GetPCLsb(branchPC);
-        ADDRINT phtIndex = (pclsb ^ GHR) & lsbMask;
-        return phtIndex;
+static VOID FlushAllBulkCounts() {
+    for (size_t i = 0; i < bulkBranchIds.size(); i++) {
+        if (biasedBranches[bulkBranchIds[i]].bulkExecutions != 0)
+            FlushBulkCounts(bulkBranchIds[i]);
     }
+}
 
-  public:
-    GshareBranchPredictor(ADDRINT numberOfEntries){
-		PHT = std::vector<std::bitset<2>>(numberOfEntries);
-        for (ADDRINT i = 0; i < PHT.size(); i += 1) {
-            PHT[i] = 0b11;
-        }
+// Go back to simulating a branch one execution at a time. Its bulk counting
+// instrumentation is removed the next time it is simulated, until then it
+// sends every execution to the full simulation.
+//
+static VOID StopBulkCounting(UINT32 branchId) {
+    BiasedBranch &branch = biasedBranches[branchId];
+    FlushBulkCounts(branchId);
+    branch.bulkOutcome = BULK_NONE;
+    branch.runLength = 0;
+    branch.reinstrument = 1;
+}
 
-        ghrEntryLength = log2(numberOfEntries);
-        lsbMask = 0;
-        for (ADDRINT i = 0; i < ghrEntryLength; i+= 1) {
-            lsbMask = lsbMask << 1;
-            lsbMask = lsbMask | 0b1;
-        }
-    }; 
+// With -profile_record, the branches are counted in branchStats and the
+// profile is written at exit. With -profile_use, profile is the one read.
+//
+static bool profiling = false;
+static bool profileLoaded = false;
+static BranchProfile profile;
 
-    virtual bool getPrediction(ADDRINT branchPC) { 
-        // PHT[ GHR XOR branchPC]
-        std::bitset<2> saturator = PHT[GetPhtIndex(branchPC)];
-        return saturator[1];
-    } 
+// With -window_length, the instructions before the window are only counted,
+// and the window starts over from iCount 0 with the branches instrumented
+//
+static bool measuring = true;   // false while fast-forwarding to the window
+static UINT64 windowStart = 0;  // instructions fast-forwarded
+static UINT64 windowLength = 0; // instructions measured, 0 for the whole run
 
-    virtual void train(ADDRINT branchPC, bool branchWasTaken) {
+// Append the counters of the interval ending now to the interval CSV, or to
+// the profile
+//
+static VOID WriteInterval() {
+    FlushAllBulkCounts();
+
+    UINT64 instructions = iCount - intervalStartICount;
+    UINT64 branches = conditionalBranchesCount - intervalStartBranches;
+    UINT64 correct = correctPredictionCount - intervalStartCorrect;
+    UINT64 taken = takenBranchesCount - intervalStartTaken;
+
+    if (profiling)
+        profile.intervalBranches.push_back(branches);
+
+    if (IntervalFile.is_open())
+        IntervalFile << intervalNumber << "," << iCount << "," << instructions
+                 << "," << branches << ","
+                 << (branches ? (double)correct / branches : 0) << ","
+                 << (instructions ? 1000.0 * (branches - correct) / instructions : 0)
+                 << "," << (branches ? (double)taken / branches : 0) << endl;
+
+    intervalNumber++;
+    intervalStartICount = iCount;
+    intervalStartBranches = conditionalBranchesCount;
+    intervalStartCorrect = correctPredictionCount;
+    intervalStartTaken = takenBranchesCount;
+    nextIntervalEnd = iCount + intervalLength;
+}
 
-        ADDRINT phtIndex = GetPhtIndex(branchPC);
+// Find the instruction count at which docount() has to run next
+//
+static VOID ScheduleCheckpoint() {
+    nextCheckpoint = (iCount / SIMULATOR_HEARTBEAT_INSTR_NUM + 1) *
+                     SIMULATOR_HEARTBEAT_INSTR_NUM;
+    if (nextIntervalEnd > iCount && nextIntervalEnd < nextCheckpoint)
+        nextCheckpoint = nextIntervalEnd;
+    if (STOP_INSTR_NUM > iCount && STOP_INSTR_NUM < nextCheckpoint)
+        nextCheckpoint = STOP_INSTR_NUM;
+    UINT64 windowCheckpoint = measuring ? windowLength : windowStart;
+    if (windowCheckpoint > iCount && windowCheckpoint < nextCheckpoint)
+        nextCheckpoint = windowCheckpoint;
+}
 
-        // update global history
-        GHR = GHR << 1;
-        GHR += branchWasTaken;
+// Start measuring from iCount 0, with every branch re-instrumented
+//
+static VOID StartWindow() {
+    measuring = true;
+    iCount = 0;
+    nextIntervalEnd = intervalLength;
+    PIN_RemoveInstrumentation();
+}
 
-        // // update saturator
-        std::bitset<2> saturator = PHT[phtIndex];
-        if (branchWasTaken) { // strengthen
-            PHT[phtIndex] = saturatorStrengthen(saturator); 
+// Update instruction counter, and tell Pin whether to call docount()
+//
+static ADDRINT CountInstruction() {
+    return ++iCount == nextCheckpoint;
+}
 
-        } else { // weaken
-            PHT[phtIndex] = saturatorWeaken(saturator); 
-        }
+VOID docount() {
+    // Print this message every SIMULATOR_HEARTBEAT_INSTR_NUM executed
+    if (iCount % SIMULATOR_HEARTBEAT_INSTR_NUM == 0) {
+        std::cerr << "Executed " << iCount << " instructions." << endl;
+    }
+    // Close the interval every intervalLength instructions
+    if (iCount == nextIntervalEnd) {
+        WriteInterval();
+    }
+    // Release control of application if STOP_INSTR_NUM instructions have been
+    // executed, or at the end of the measurement window
+    if (iCount == STOP_INSTR_NUM || (measuring && iCount == windowLength)) {
+        PIN_Detach();
+    }
+    if (!measuring && iCount == windowStart) {
+        StartWindow();
+    }
+    ScheduleCheckpoint();
+}
 
-    } 
+// Where a branch is, with "??" for what is unknown
+//
+struct BranchLocation {
+    string image;   // image+offset
+    string routine;
+    string source;  // file:line
 };
 
+// Resolve a branch PC to its location. Only called at Fini, so symbol lookups
+// cost nothing while the benchmark runs.
+//
+static BranchLocation LocateBranch(ADDRINT branchPC) {
+    BranchLocation location;
+    location.image = "??";
+    for (size_t i = 0; i < loadedImages.size(); i++) {
+        if (branchPC >= loadedImages[i].low && branchPC <= loadedImages[i].high) {
+            location.image = loadedImages[i].name + "+" +
+                             hexstr(branchPC - loadedImages[i].low);
+            break;
+        }
+    }
 
-class TournamentBranchPredictor : public BranchPredictorInterface {
-  private:
-	std::vector<std::bitset<2>> PHT; 
-    ADDRINT lsbMask;
-    LocalBranchPredictor * localPredictor;  
-    GshareBranchPredictor * gsharePredictor;
+    location.routine = "??";
+    string fileName;
+    INT32 line = 0;
+    PIN_LockClient();
+    RTN rtn = RTN_FindByAddress(branchPC);
+    if (RTN_Valid(rtn))
+        location.routine = RTN_Name(rtn);
+    PIN_GetSourceLocation(branchPC, NULL, &line, &fileName);
+    PIN_UnlockClient();
+
+    location.source = "??";
+    if (!fileName.empty())
+        location.source = fileName + ":" + decstr(line);
+    return location;
+}
 
-    int GetPCLsb(ADDRINT branchPC){
-        ADDRINT pclsb = branchPC & lsbMask;
-        return pclsb;
+// Select the top-N static branches by misprediction count, and by
+// misprediction rate among the branches executed often enough
+//
+static VOID SelectHardestBranches(UINT32 topCount,
+                                  std::vector<BranchStats> &byMispredictions,
+                                  std::vector<BranchStats> &byRate) {
+    branchStats.Collect(byMispredictions);
+    byRate.clear();
+    for (size_t i = 0; i < byMispredictions.size(); i++) {
+        if (byMispredictions[i].executions >= BRANCH_STATS_MIN_EXECUTIONS)
+            byRate.push_back(byMispredictions[i]);
     }
 
-    int GetPhtIndex(ADDRINT branchPC){
-        return GetPCLsb(branchPC);
-    }
+    size_t count = std::min<size_t>(topCount, byMispredictions.size());
+    std::partial_sort(byMispredictions.begin(), byMispredictions.begin() + count,
+                      byMispredictions.end(), MoreMispredictions);
+    byMispredictions.resize(count);
+    count = std::min<size_t>(topCount, byRate.size());
+    std::partial_sort(byRate.begin(), byRate.begin() + count, byRate.end(),
+                      HigherMispredictionRate);
+    byRate.resize(count);
+}
 
-  public:
-    TournamentBranchPredictor(ADDRINT numberOfEntries){
-        localPredictor = new LocalBranchPredictor(numberOfEntries);        
-        gsharePredictor = new GshareBranchPredictor(numberOfEntries);
+// Print the top-N static branches by misprediction count, with their share of
+// the MPKI, and by misprediction rate
+//
+static VOID PrintHardestBranches(std::ostream &out, UINT32 topCount) {
+    std::vector<BranchStats> byMispredictions, byRate;
+    SelectHardestBranches(topCount, byMispredictions, byRate);
+    UINT64 mispredictionCount = conditionalBranchesCount - correctPredictionCount;
 
-		PHT = std::vector<std::bitset<2>>(numberOfEntries);
-        for (ADDRINT i = 0; i < PHT.size(); i += 1) {
-            PHT[i] = 0b11;
-        }
+    out << endl
+        << "Number of static conditional branches:\t" << branchStats.Size() << endl
+        << endl
+        << "Hardest branches by mispredictions:" << endl
+        << "PC\tExecutions\tTaken\tMispredictions\tMisprediction rate\tMPKI"
+           "\tCumulative share\tImage\tRoutine\tSource"
+        << endl;
+    UINT64 cumulative = 0;
+    for (size_t i = 0; i < byMispredictions.size(); i++) {
+        const BranchStats &branch = byMispredictions[i];
+        BranchLocation location = LocateBranch(branch.pc);
+        cumulative += branch.mispredictions;
+        out << StringFromAddrint(branch.pc) << "\t" << branch.executions << "\t"
+            << branch.takenCount << "\t" << branch.mispredictions << "\t"
+            << (double)branch.mispredictions / branch.executions << "\t"
+            << 1000.0 * branch.mispredictions / iCount << "\t"
+            << (double)cumulative / mispredictionCount << "\t" << location.image
+            << "\t" << location.routine << "\t" << location.source << endl;
+    }
 
-        lsbMask = 0;
-        for (ADDRINT i = 0; i < log2(numberOfEntries); i+= 1) {
-            lsbMask = lsbMask << 1;
-            lsbMask = lsbMask | 0b1;
-        }
-    }; 
-
-    virtual bool getPrediction(ADDRINT branchPC) { 
-        // PHT[ branchPC]
-        std::bitset<2> saturator = PHT[GetPhtIndex(branchPC)];
-        if (saturator[1] == 1){ // use gshare
-            return gsharePredictor->getPrediction(branchPC);
-        } else { // use local
-            return localPredictor->getPrediction(branchPC);
-        }
-    } 
+    out << endl
+        << "Hardest branches by misprediction rate (at least "
+        << BRANCH_STATS_MIN_EXECUTIONS << " executions):" << endl
+        << "PC\tExecutions\tTaken\tMispredictions\tMisprediction rate\tMPKI"
+           "\tImage\tRoutine\tSource"
+        << endl;
+    for (size_t i = 0; i < byRate.size(); i++) {
+        const BranchStats &branch = byRate[i];
+        BranchLocation location = LocateBranch(branch.pc);
+        out << StringFromAddrint(branch.pc) << "\t" << branch.executions << "\t"
+            << branch.takenCount << "\t" << branch.mispredictions << "\t"
+            << (double)branch.mispredictions / branch.executions << "\t"
+            << 1000.0 * branch.mispredictions / iCount << "\t" << location.image
+            << "\t" << location.routine << "\t" << location.source << endl;
+    }
+}
 
-    virtual void train(ADDRINT branchPC, bool branchWasTaken) {
+static string JsonString(const string &text) {
+    string quoted = "\"";
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '"' || text[i] == '\\')
+            quoted += '\\';
+        if ((unsigned char)text[i] >= 0x20)
+            quoted += text[i];
+    }
+    return quoted + "\"";
+}
 
-        ADDRINT phtIndex = GetPhtIndex(branchPC);
-        std::bitset<2> saturator = PHT[phtIndex];
+// Ratio that stays a valid JSON number when there was nothing to count
+//
+static double JsonRatio(double numerator, double denominator) {
+    return denominator == 0 ? 0 : numerator / denominator;
+}
 
-        // correct prediction -> meta-predictor entry is strengthened
-        // mis-prediction && the unselected predictor correct -> meta-predictor entry is weakened
-        // mis-prediction && both predictors wrong -> do not update meta-predictor
+static VOID WriteJsonBranches(std::ostream &out, const char *name,
+                              const std::vector<BranchStats> &branches) {
+    out << "  \"" << name << "\": [";
+    for (size_t i = 0; i < branches.size(); i++) {
+        const BranchStats &branch = branches[i];
+        BranchLocation location = LocateBranch(branch.pc);
+        out << (i ? "," : "") << endl
+            << "    {\"pc\": " << JsonString(StringFromAddrint(branch.pc))
+            << ", \"executions\": " << branch.executions
+            << ", \"taken\": " << branch.takenCount
+            << ", \"mispredictions\": " << branch.mispredictions
+            << ", \"mpki\": " << JsonRatio(1000.0 * branch.mispredictions, iCount)
+            << ", \"image\": " << JsonString(location.image)
+            << ", \"routine\": " << JsonString(location.routine)
+            << ", \"source\": " << JsonString(location.source) << "}";
+    }
+    out << endl << "  ]";
+}
 
-        // update saturator
+// Write every counter, the predictor configuration and the simulation speed
+// as one JSON object, one scalar per line
+//
+static VOID WriteJsonStats(std::ostream &out, double wallSeconds) {
+    UINT64 mispredictionCount = conditionalBranchesCount - correctPredictionCount;
+    out << "{" << endl
+        << "  \"predictor\": {" << endl
+        << "    \"type\": " << JsonString(KnobBranchPredictorType.Value()) << ","
+        << endl
+        << "    \"entries\": " << KnobNumberOfEntriesInBranchPredictor.Value()
+        << "," << endl
+        << "    \"history_length\": " << KnobHistoryLength.Value() << "," << endl
+        << "    \"counter_bits\": " << KnobCounterBits.Value() << "," << endl
+        << "    \"lhr_entries\": " << KnobLocalHistoryEntries.Value() << ","
+        << endl
+        << "    \"chooser_entries\": " << KnobChooserEntries.Value() << ","
+        << endl
+        << "    \"storage_bits\": " << branchPredictor->getStorageBits() << endl
+        << "  }," << endl
+        << "  \"accuracy\": "
+        << JsonRatio(correctPredictionCount, conditionalBranchesCount) << ","
+        << endl
+        << "  \"mpki\": " << JsonRatio(1000.0 * mispredictionCount, iCount) << ","
+        << endl
+        << "  \"instructions\": " << iCount << "," << endl
+        << "  \"conditional_branches\": " << conditionalBranchesCount << ","
+        << endl
+        << "  \"correct_predictions\": " << correctPredictionCount << "," << endl
+        << "  \"mispredictions\": " << mispredictionCount << "," << endl
+        << "  \"taken_branches\": " << takenBranchesCount << "," << endl
+        << "  \"not_taken_branches\": " << notTakenBranchesCount << "," << endl
+        << "  \"predicted_taken_branches\": " << predictedTakenBranchesCount
+        << "," << endl
+        << "  \"predicted_not_taken_branches\": "
+        << predictedNotTakenBranchesCount << "," << endl
+        << "  \"wall_seconds\": " << wallSeconds << "," << endl
+        << "  \"simulated_mips\": " << JsonRatio(iCount / 1e6, wallSeconds);
+
+    if (branchStats.IsEnabled()) {
+        std::vector<BranchStats> byMispredictions, byRate;
+        SelectHardestBranches(KnobTopBranches.Value(), byMispredictions, byRate);
+        out << "," << endl
+            << "  \"static_branches\": " << branchStats.Size() << "," << endl;
+        WriteJsonBranches(out, "hardest_branches_by_mispredictions",
+                          byMispredictions);
+        out << "," << endl;
+        WriteJsonBranches(out, "hardest_branches_by_misprediction_rate", byRate);
+    }
+    out << endl << "}" << endl;
+}
 
-        bool isTournamentCorrect = true;
-        bool isLocalCorrect = localPredictor->getPrediction(branchPC) == branchWasTaken;
-        bool isGshareCorrect = gsharePredictor->getPrediction(branchPC) == branchWasTaken;
+// Seconds since the epoch, for the simulation wall time
+//
+static double WallClock() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec / 1e6;
+}
 
-        if (saturator[1] == 0){ // selected local
-            if (isLocalCorrect) { // if local is correct
-                PHT[phtIndex] = saturatorWeaken(saturator); // strengthen local
-            } else {
-                isTournamentCorrect = false;
-            }
-        } else { // selected gshare
-            if (isGshareCorrect) { // if gshare is correct
-                PHT[phtIndex] = saturatorStrengthen(saturator); // strengthen gshare
-            } else {
-                isTournamentCorrect = false; 
-            }
-        }
+VOID TerminateSimulationHandler(VOID *v) {
+    if (!traceWriter.Close(iCount)) {
+        std::cerr << "Error: cannot write trace file " << KnobTraceFile.Value()
+                  << endl;
+        std::exit(EXIT_FAILURE);
+    }
 
-        if (!isTournamentCorrect) { // if prediction was wrong
-            if (isLocalCorrect) { // if local is correct
-                PHT[phtIndex] = saturatorWeaken(saturator); // strengthen local
-            } else if (isGshareCorrect) { // if gshare is correct
-                PHT[phtIndex] = saturatorStrengthen(saturator); // strengthen gshare
-            } // else do nothing
+    if (profiling) {
+        if (iCount > intervalStartICount)
+            WriteInterval();
+        std::vector<BranchStats> executed;
+        branchStats.Collect(executed);
+        for (size_t i = 0; i < executed.size(); i++)
+            profile.branches[executed[i].pc] = executed[i];
+        profile.instructions = iCount;
+        profile.intervalLength = intervalLength;
+        profile.staticBranches = staticBranchIds.size();
+        if (!profile.Save(KnobProfileRecord.Value())) {
+            std::cerr << "Error: cannot write profile file "
+                      << KnobProfileRecord.Value() << endl;
+            std::exit(EXIT_FAILURE);
         }
+        std::cerr << "Profiled " << executed.size()
+                  << " static conditional branches." << endl;
+        std::exit(EXIT_SUCCESS);
+    }
 
-        // train gshare and local
-        gsharePredictor->train(branchPC, branchWasTaken);
-        localPredictor->train(branchPC, branchWasTaken);
-
-    } 
-};
-
-ofstream OutFile;
-BranchPredictorInterface *branchPredictor;
-
-// Define the command line arguments that Pin should accept for this tool
-//
-KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "BP_stats.out",
-                            "specify output file name");
-KNOB<UINT64> KnobNumberOfEntriesInBranchPredictor(
-    KNOB_MODE_WRITEONCE, "pintool", "num_BP_entries", "1024",
-    "specify number of entries in a branch predictor");
-KNOB<string>
-    KnobBranchPredictorType(KNOB_MODE_WRITEONCE, "pintool", "BP_type",
-                            "always_taken",
-                            "specify type of branch predictor to be used");
-
-// The running counts of branches, predictions and instructions are kept here
-//
-static UINT64 iCount = 0;
-static UINT64 correctPredictionCount = 0;
-static UINT64 conditionalBranchesCount = 0;
-static UINT64 takenBranchesCount = 0;
-static UINT64 notTakenBranchesCount = 0;
-static UINT64 predictedTakenBranchesCount = 0;
-static UINT64 predictedNotTakenBranchesCount = 0;
+    if (biasTracking) {
+        FlushAllBulkCounts();
+        std::cerr << "Counted " << bulkExecutionsCount << " of "
+                  << conditionalBranchesCount
+                  << " conditional branches in bulk." << endl;
+    }
 
-VOID docount() {
-    // Update instruction counter
-    iCount++;
-    // Print this message every SIMULATOR_HEARTBEAT_INSTR_NUM executed
-    if (iCount % SIMULATOR_HEARTBEAT_INSTR_NUM == 0) {
-        std::cerr << "Executed " << iCount << " instructions." << endl;
+    // The fast path only counts what the not-taken counts are derived from
+    if (fastPath) {
+        notTakenBranchesCount = conditionalBranchesCount - takenBranchesCount;
+        predictedNotTakenBranchesCount =
+            conditionalBranchesCount - predictedTakenBranchesCount;
     }
-    // Release control of application if STOP_INSTR_NUM instructions have been
-    // executed
-    if (iCount == STOP_INSTR_NUM) {
-        PIN_Detach();
+
+    // Close the last, partial interval
+    if (IntervalFile.is_open()) {
+        if (iCount > intervalStartICount)
+            WriteInterval();
+        IntervalFile.close();
     }
-}
 
-VOID TerminateSimulationHandler(VOID *v) {
     OutFile.setf(ios::showbase);
     // At the end of a simulation, print counters to a file
-    OutFile << "Prediction accuracy:\t"
-            << (double)correctPredictionCount / (double)conditionalBranchesCount
-            << endl
-            << "Number of conditional branches:\t" << conditionalBranchesCount
-            << endl
-            << "Number of correct predictions:\t" << correctPredictionCount
-            << endl
-            << "Number of taken branches:\t" << takenBranchesCount << endl
-            << "Number of non-taken branches:\t" << notTakenBranchesCount
-            << endl;
+    if (KnobStatsFormat.Value() == "json") {
+        WriteJsonStats(OutFile, WallClock() - simulationStartTime);
+    } else {
+        OutFile << "Prediction accuracy:\t"
+                << (double)correctPredictionCount / (double)conditionalBranchesCount
+                << endl
+                << "Number of conditional branches:\t" << conditionalBranchesCount
+                << endl
+                << "Number of correct predictions:\t" << correctPredictionCount
+                << endl
+                << "Number of taken branches:\t" << takenBranchesCount << endl
+                << "Number of non-taken branches:\t" << notTakenBranchesCount
+                << endl
+                << "Number of predicted taken branches:\t"
+                << predictedTakenBranchesCount << endl
+                << "Number of predicted non-taken branches:\t"
+                << predictedNotTakenBranchesCount << endl
+                << "Number of instructions:\t" << iCount << endl;
+        if (branchStats.IsEnabled())
+            PrintHardestBranches(OutFile, KnobTopBranches.Value());
+    }
     OutFile.close();
 
     std::cerr << endl
@@ -345,21 +647,66 @@ VOID TerminateSimulationHandler(VOID *v) {
 //
 VOID Fini(int code, VOID *v) { TerminateSimulationHandler(v); }
 
-// This function is called before every conditional branch is executed
+// Track how long a branch has resolved the same way, and switch it to bulk
+// counting when it is biased and the predictor is steady for it
 //
-static VOID AtConditionalBranch(ADDRINT branchPC, BOOL branchWasTaken) {
+static VOID TrackBias(UINT32 branchId, ADDRINT branchPC, ADDRINT staticKey,
+                      bool branchWasTaken) {
+    BiasedBranch &branch = biasedBranches[branchId];
+    if (branch.bulkOutcome != BULK_NONE) {
+        // Reached through the instrumentation from before the switch, which
+        // is exact as long as the branch keeps resolving the same way
+        if (branchWasTaken != branch.bulkOutcome)
+            StopBulkCounting(branchId);
+    }
+    if (branch.reinstrument) {
+        branch.reinstrument = 0;
+        PIN_RemoveInstrumentationInRange(branchPC, branchPC);
+    }
+    if (branch.bulkOutcome != BULK_NONE)
+        return;
+
+    if (branchWasTaken != branch.runOutcome) {
+        branch.runOutcome = branchWasTaken;
+        branch.runLength = 0;
+    }
+    if (branch.threshold == 0 || ++branch.runLength < branch.threshold)
+        return;
+    branch.runLength = 0;
+    if (branch.sharedKey ||
+        !branchPredictor->isSteadyForKey(staticKey, branchWasTaken)) {
+        // Not steady yet, or never: check again later, and less often
+        if (branch.threshold < BIAS_MAX_THRESHOLD)
+            branch.threshold *= 2;
+        return;
+    }
+
+    branch.bulkOutcome = branchWasTaken;
+    branch.bulkPrediction = branchPredictor->getPredictionForKey(staticKey);
+    if (!branch.listed) {
+        branch.listed = 1;
+        bulkBranchIds.push_back(branchId);
+    }
+    PIN_RemoveInstrumentationInRange(branchPC, branchPC);
+}
+
+// This function is called for every executed conditional branch
+//
+static inline VOID PredictBranch(UINT32 branchId, ADDRINT branchPC,
+                                 ADDRINT staticKey, bool branchWasTaken) {
     /*
      * This is the place where the predictor is queried for a prediction and
      * trained
      */
 
-    // Step 1: make a prediction for the current branch PC
+    // Step 1: make a prediction for the current branch, using the static key
+    // the predictor computed from its PC at instrumentation time
     //
-    bool wasPredictedTaken = branchPredictor->getPrediction(branchPC);
+    bool wasPredictedTaken = branchPredictor->getPredictionForKey(staticKey);
 
     // Step 2: train the predictor by passing it the actual branch outcome
     //
-    branchPredictor->train(branchPC, branchWasTaken);
+    branchPredictor->trainForKey(staticKey, branchWasTaken);
 
     // Count the number of conditional branches executed
     conditionalBranchesCount++;
@@ -381,6 +728,169 @@ static VOID AtConditionalBranch(ADDRINT branchPC, BOOL branchWasTaken) {
     // Count the number of correct predictions
     if (wasPredictedTaken == branchWasTaken)
         correctPredictionCount++;
+
+    // Count the branch in its per static branch statistics
+    if (branchStats.IsEnabled())
+        branchStats.Record(branchId, branchWasTaken,
+                           wasPredictedTaken != branchWasTaken);
+
+    // Capture the branch for offline replay
+    if (traceWriter.IsOpen())
+        traceWriter.AppendWithId(branchId, branchPC, branchWasTaken);
+
+    if (biasTracking)
+        TrackBias(branchId, branchPC, staticKey, branchWasTaken);
+}
+
+// This function is called before every conditional branch is executed
+//
+static VOID AtConditionalBranch(UINT32 branchId, ADDRINT branchPC,
+                                ADDRINT staticKey, BOOL branchWasTaken) {
+    PredictBranch(branchId, branchPC, staticKey, branchWasTaken);
+}
+
+// With edge instrumentation, these functions are called on the taken and on
+// the fall-through edge of every conditional branch, so the outcome is a
+// constant and Pin does not have to compute it
+//
+static VOID AtTakenBranch(UINT32 branchId, ADDRINT branchPC,
+                          ADDRINT staticKey) {
+    PredictBranch(branchId, branchPC, staticKey, true);
+}
+
+static VOID AtNotTakenBranch(UINT32 branchId, ADDRINT branchPC,
+                             ADDRINT staticKey) {
+    PredictBranch(branchId, branchPC, staticKey, false);
+}
+
+// With -profile_record, this function is called for every conditional branch
+// instead of the predictor
+//
+static VOID ProfileBranch(UINT32 branchId, BOOL branchWasTaken) {
+    conditionalBranchesCount++;
+    branchStats.Record(branchId, branchWasTaken, false);
+}
+
+// Count an execution of a branch counted in bulk. This is inlined, and Pin
+// only calls AtConditionalBranch() after it when the branch resolved the
+// other way or is not counted in bulk any more.
+//
+static ADDRINT CountBiasedBranch(UINT32 branchId, BOOL branchWasTaken) {
+    BiasedBranch &branch = biasedBranches[branchId];
+    UINT32 matches = (branchWasTaken != 0) == branch.bulkOutcome;
+    branch.bulkExecutions += matches;
+    return !matches;
+}
+
+// Predict, train and count one conditional branch on the fast path. This is
+// straight line code without calls, so that Pin inlines it.
+//
+static inline VOID FastPredictBranch(ADDRINT pclsb, UINT32 branchWasTaken) {
+    ADDRINT index = (pclsb ^ (fastGHR & fastHistoryMask)) & fastIndexMask;
+    UINT8 counter = fastPHT[index];
+    UINT32 wasPredictedTaken = counter > fastCounterThreshold;
+    fastPHT[index] = fastNextCounter[branchWasTaken][counter];
+    fastGHR = (fastGHR << 1) | branchWasTaken;
+
+    conditionalBranchesCount++;
+    takenBranchesCount += branchWasTaken;
+    predictedTakenBranchesCount += wasPredictedTaken;
+    correctPredictionCount += wasPredictedTaken == branchWasTaken;
+}
+
+static VOID FastAtConditionalBranch(ADDRINT pclsb, BOOL branchWasTaken) {
+    FastPredictBranch(pclsb, branchWasTaken != 0);
+}
+
+static VOID FastAtTakenBranch(ADDRINT pclsb) { FastPredictBranch(pclsb, 1); }
+
+static VOID FastAtNotTakenBranch(ADDRINT pclsb) { FastPredictBranch(pclsb, 0); }
+
+// Set up the fast path globals for the given predictor, which must behave
+// exactly like branchPredictor. Return false when the predictor has no fast
+// path: gshare only has one when its history needs no folding.
+//
+static bool InitFastPath(const string &type, UINT64 numberOfEntries,
+                         const BranchPredictorParams &params) {
+    UINT32 indexBits = IndexBits(numberOfEntries);
+    UINT32 historyLength = 0;
+    if (type == "gshare") {
+        historyLength = params.historyLength ? params.historyLength : indexBits;
+        if (historyLength > indexBits)
+            return false;
+    } else if (type != "bimodal") {
+        return false;
+    }
+
+    UINT8 saturatorMax = LsbMask(params.counterBits ? params.counterBits : 2);
+    fastPHT = new UINT8[numberOfEntries];
+    for (UINT64 i = 0; i < numberOfEntries; i++)
+        fastPHT[i] = saturatorMax;
+    for (UINT32 counter = 0; counter < 256; counter++) {
+        fastNextCounter[0][counter] = saturatorWeaken(counter);
+        fastNextCounter[1][counter] = saturatorStrengthen(counter, saturatorMax);
+    }
+    fastCounterThreshold = saturatorMax / 2;
+    fastIndexMask = LsbMask(indexBits);
+    fastHistoryMask = LsbMask(historyLength);
+    return true;
+}
+
+// Record which static branches share a static key. Bulk counting is exact only
+// for branches that are alone with their key, so it stops for the branch that
+// had the key until now.
+//
+static VOID AddStaticKey(UINT32 branchId, ADDRINT staticKey) {
+    std::map<ADDRINT, UINT32>::iterator it = staticKeyOwners.find(staticKey);
+    if (it == staticKeyOwners.end()) {
+        staticKeyOwners[staticKey] = branchId;
+        return;
+    }
+    biasedBranches[branchId].sharedKey = 1;
+    if (it->second == KEY_SHARED)
+        return;
+    biasedBranches[it->second].sharedKey = 1;
+    if (biasedBranches[it->second].bulkOutcome != BULK_NONE)
+        StopBulkCounting(it->second);
+    it->second = KEY_SHARED;
+}
+
+// Return the dense ID of a static conditional branch, assigning the next one
+// the first time the branch is instrumented
+//
+static UINT32 GetStaticBranchId(ADDRINT branchPC, ADDRINT staticKey) {
+    std::map<ADDRINT, UINT32>::iterator it = staticBranchIds.find(branchPC);
+    if (it != staticBranchIds.end())
+        return it->second;
+
+    UINT32 branchId = staticBranchIds.size();
+    staticBranchIds[branchPC] = branchId;
+    if (branchStats.IsEnabled())
+        branchStats.AddBranch(branchId, branchPC);
+    if (biasTracking) {
+        // Branches the profile shows fully biased switch as soon as the
+        // predictor is steady for them
+        UINT32 threshold = biasThreshold;
+        if (profileLoaded && profile.IsFullyBiased(branchPC))
+            threshold = 1;
+        BiasedBranch unbiased = {0, 0, 0, BULK_NONE, 0, threshold, 0, 0, 0};
+        biasedBranches.push_back(unbiased);
+        AddStaticKey(branchId, staticKey);
+    }
+    return branchId;
+}
+
+// Remember the address range of every image for LocateBranch()
+//
+VOID ImageLoad(IMG img, VOID *v) {
+    LoadedImage image;
+    image.low = IMG_LowAddress(img);
+    image.high = IMG_HighAddress(img);
+    image.name = IMG_Name(img);
+    size_t slash = image.name.rfind('/');
+    if (slash != string::npos)
+        image.name = image.name.substr(slash + 1);
+    loadedImages.push_back(image);
 }
 
 // Pin calls this function every time a new instruction is encountered
@@ -393,12 +903,65 @@ static VOID AtConditionalBranch(ADDRINT branchPC, BOOL branchWasTaken) {
 VOID Instruction(INS ins, VOID *v) {
     // Insert a call before every instruction that simply counts instructions
     // executed
-    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)docount, IARG_END);
+    INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)CountInstruction, IARG_END);
+    INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)docount, IARG_END);
 
-    // Insert a call before every conditional branch
+    // Branches are instrumented from the start of the measurement window
+    if (!measuring)
+        return;
+
+    // Insert a call before every conditional branch, or on both of its edges
     if (INS_IsBranch(ins) && INS_HasFallThrough(ins)) {
-        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)AtConditionalBranch,
-                       IARG_INST_PTR, IARG_BRANCH_TAKEN, IARG_END);
+        if (profiling) {
+            UINT32 branchId = GetStaticBranchId(INS_Address(ins), INS_Address(ins));
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ProfileBranch,
+                           IARG_UINT32, branchId, IARG_BRANCH_TAKEN, IARG_END);
+            return;
+        }
+
+        // The PC dependent part of the predictor's indices is computed once
+        // here instead of on every execution of the branch
+        ADDRINT staticKey = branchPredictor->getStaticKey(INS_Address(ins));
+        bool edges = edgeInstrumentation && INS_IsValidForIpointTakenBranch(ins) &&
+                     INS_IsValidForIpointAfter(ins);
+        if (fastPath) {
+            if (edges) {
+                INS_InsertCall(ins, IPOINT_TAKEN_BRANCH,
+                               (AFUNPTR)FastAtTakenBranch, IARG_ADDRINT,
+                               staticKey, IARG_END);
+                INS_InsertCall(ins, IPOINT_AFTER, (AFUNPTR)FastAtNotTakenBranch,
+                               IARG_ADDRINT, staticKey, IARG_END);
+            } else {
+                INS_InsertCall(ins, IPOINT_BEFORE,
+                               (AFUNPTR)FastAtConditionalBranch, IARG_ADDRINT,
+                               staticKey, IARG_BRANCH_TAKEN, IARG_END);
+            }
+            return;
+        }
+
+        UINT32 branchId = GetStaticBranchId(INS_Address(ins), staticKey);
+        if (biasTracking &&
+            biasedBranches[branchId].bulkOutcome != BULK_NONE) {
+            // Counted in bulk, with the outcome read before the branch even
+            // with edge instrumentation
+            INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)CountBiasedBranch,
+                             IARG_UINT32, branchId, IARG_BRANCH_TAKEN, IARG_END);
+            INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)AtConditionalBranch,
+                               IARG_UINT32, branchId, IARG_INST_PTR,
+                               IARG_ADDRINT, staticKey, IARG_BRANCH_TAKEN,
+                               IARG_END);
+        } else if (edges) {
+            INS_InsertCall(ins, IPOINT_TAKEN_BRANCH, (AFUNPTR)AtTakenBranch,
+                           IARG_UINT32, branchId, IARG_ADDRINT, INS_Address(ins),
+                           IARG_ADDRINT, staticKey, IARG_END);
+            INS_InsertCall(ins, IPOINT_AFTER, (AFUNPTR)AtNotTakenBranch,
+                           IARG_UINT32, branchId, IARG_ADDRINT, INS_Address(ins),
+                           IARG_ADDRINT, staticKey, IARG_END);
+        } else {
+            INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)AtConditionalBranch,
+                           IARG_UINT32, branchId, IARG_INST_PTR,
+                           IARG_ADDRINT, staticKey, IARG_BRANCH_TAKEN, IARG_END);
+        }
     }
 }
 
@@ -414,33 +977,176 @@ int main(int argc, char *argv[]) {
     if (PIN_Init(argc, argv))
         return Usage();
 
+    for (UINT32 i = 0; i < KnobPlugin.NumberOfValues(); i++) {
+        std::string error;
+        if (!KnobPlugin.Value(i).empty() &&
+            !LoadBranchPredictorPlugin(KnobPlugin.Value(i), error)) {
+            std::cerr << "Error: cannot load predictor plugin: " << error << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
     // Create a branch predictor object of requested type
-    if (KnobBranchPredictorType.Value() == "always_taken") {
-        std::cerr << "Using always taken BP" << std::endl;
-        branchPredictor = new AlwaysTakenBranchPredictor(
-            KnobNumberOfEntriesInBranchPredictor.Value());
-    } else if (KnobBranchPredictorType.Value() == "local") {
-        std::cerr << "Using Local BP." << std::endl;
-        branchPredictor = new LocalBranchPredictor(KnobNumberOfEntriesInBranchPredictor.Value());
-    } else if (KnobBranchPredictorType.Value() == "gshare") {
-        std::cerr << "Using Gshare BP." << std::endl;
-           branchPredictor = new GshareBranchPredictor(KnobNumberOfEntriesInBranchPredictor.Value());
-    } else if (KnobBranchPredictorType.Value() == "tournament") {
-        std::cerr << "Using Tournament BP." << std::endl;
-        branchPredictor = new TournamentBranchPredictor(KnobNumberOfEntriesInBranchPredictor.Value());
-    } else {
+    BranchPredictorParams params;
+    params.historyLength = KnobHistoryLength.Value();
+    params.counterBits = KnobCounterBits.Value();
+    params.localHistoryEntries = KnobLocalHistoryEntries.Value();
+    params.chooserEntries = KnobChooserEntries.Value();
+    UINT32 unsupported = UnsupportedPredictorParams(KnobBranchPredictorType.Value(), params);
+    if (unsupported != 0) {
+        const UINT32 paramBits[] = {PREDICTOR_PARAM_HIST, PREDICTOR_PARAM_CTR,
+                                    PREDICTOR_PARAM_LHR, PREDICTOR_PARAM_CHOOSER};
+        const char *knobNames[] = {"-history_length", "-counter_bits",
+                                   "-lhr_entries", "-chooser_entries"};
+        std::cerr << "Error: " << KnobBranchPredictorType.Value()
+                  << " BP does not take";
+        for (int i = 0; i < 4; i++) {
+            if (unsupported & paramBits[i])
+                std::cerr << " " << knobNames[i];
+        }
+        std::cerr << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    branchPredictor =
+        CreateBranchPredictor(KnobBranchPredictorType.Value(),
+                              KnobNumberOfEntriesInBranchPredictor.Value(),
+                              params);
+    if (branchPredictor == NULL) {
         std::cerr << KnobBranchPredictorType.Value() << std::endl;
         std::cerr << "Error: No such type of branch predictor. Simulation will "
                      "be terminated."
                   << std::endl;
         std::exit(EXIT_FAILURE);
     }
+    std::cerr << "Using " << KnobBranchPredictorType.Value() << " BP with "
+              << KnobNumberOfEntriesInBranchPredictor.Value() << " entries."
+              << std::endl;
+
+    if (KnobBranchInstrumentation.Value() != "before" &&
+        KnobBranchInstrumentation.Value() != "edge") {
+        std::cerr << "Error: No such branch instrumentation "
+                  << KnobBranchInstrumentation.Value() << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    edgeInstrumentation = KnobBranchInstrumentation.Value() == "edge";
+
+    if (KnobStatsFormat.Value() != "text" && KnobStatsFormat.Value() != "json") {
+        std::cerr << "Error: No such stats format "
+                  << KnobStatsFormat.Value() << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    if (KnobTraceFormat.Value() != "raw" &&
+        KnobTraceFormat.Value() != "compressed") {
+        std::cerr << "Error: No such trace format "
+                  << KnobTraceFormat.Value() << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+    if (!KnobTraceFile.Value().empty() &&
+        !traceWriter.Open(KnobTraceFile.Value(),
+                          KnobTraceFormat.Value() == "compressed")) {
+        std::cerr << "Error: cannot open trace file "
+                  << KnobTraceFile.Value() << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    if (KnobFastPath.Value()) {
+        if (KnobTopBranches.Value() > 0 || traceWriter.IsOpen()) {
+            std::cerr << "Error: -fast_path needs -top_branches 0 and no -trace"
+                      << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        if (!InitFastPath(KnobBranchPredictorType.Value(),
+                          KnobNumberOfEntriesInBranchPredictor.Value(), params)) {
+            std::cerr << "Error: No fast path for this branch predictor, it "
+                         "needs bimodal, or gshare with a history no longer "
+                         "than log2(num_BP_entries)"
+                      << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        fastPath = true;
+    }
+
+    if (!KnobProfileRecord.Value().empty()) {
+        if (!KnobProfileUse.Value().empty() || KnobWindowLength.Value() > 0 ||
+            fastPath || KnobBiasThreshold.Value() > 0 || traceWriter.IsOpen()) {
+            std::cerr << "Error: -profile_record cannot be used with "
+                         "-profile_use, -window_length, -fast_path, "
+                         "-bias_threshold or -trace"
+                      << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        profiling = true;
+    }
+    if (!KnobProfileUse.Value().empty()) {
+        if (!profile.Load(KnobProfileUse.Value())) {
+            std::cerr << "Error: cannot read profile file "
+                      << KnobProfileUse.Value() << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        profileLoaded = true;
+    }
+    if (KnobWindowLength.Value() > 0) {
+        if (!profileLoaded) {
+            std::cerr << "Error: -window_length needs -profile_use" << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        windowLength = KnobWindowLength.Value();
+        windowStart = profile.SelectWindow(windowLength);
+        measuring = windowStart == 0;
+        std::cerr << "Simulating " << windowLength
+                  << " instructions from instruction " << windowStart << "."
+                  << std::endl;
+    }
+
+    // The per-branch tables are sized for the branches the profile saw
+    UINT64 expectedBranches = KnobBranchStatsEntries.Value();
+    if (profileLoaded)
+        expectedBranches = profile.staticBranches;
+
+    if (KnobBiasThreshold.Value() > 0) {
+        if (fastPath || traceWriter.IsOpen()) {
+            std::cerr << "Error: -bias_threshold cannot be used with "
+                         "-fast_path or -trace"
+                      << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        biasThreshold = KnobBiasThreshold.Value();
+    }
+    biasTracking = KnobBiasThreshold.Value() > 0 ||
+                   (profileLoaded && !fastPath && !traceWriter.IsOpen());
+    if (biasTracking)
+        biasedBranches.reserve(expectedBranches);
+
+    if (profiling) {
+        branchStats.Init(KnobBranchStatsEntries.Value());
+    } else if (KnobTopBranches.Value() > 0) {
+        branchStats.Init(expectedBranches);
+        // Symbols are only read to describe the hardest branches at Fini
+        PIN_InitSymbols();
+        IMG_AddInstrumentFunction(ImageLoad, 0);
+    }
 
     std::cerr << "The simulation will run " << STOP_INSTR_NUM
               << " instructions." << std::endl;
 
     OutFile.open(KnobOutputFile.Value().c_str());
 
+    intervalLength = KnobInterval.Value();
+    if (profiling && intervalLength == 0)
+        intervalLength = PROFILE_INTERVAL_INSTR;
+    if (measuring)
+        nextIntervalEnd = intervalLength;
+    if (KnobInterval.Value() > 0 && !profiling) {
+        string intervalFile = KnobIntervalFile.Value();
+        if (intervalFile.empty())
+            intervalFile = KnobOutputFile.Value() + ".intervals.csv";
+        IntervalFile.open(intervalFile.c_str());
+        IntervalFile << "interval,end_instruction,instructions,"
+                        "conditional_branches,accuracy,mpki,taken_ratio"
+                     << endl;
+    }
+    ScheduleCheckpoint();
+
     // Pin calls Instruction() when encountering each new instruction executed
     INS_AddInstrumentFunction(Instruction, 0);
 
@@ -453,6 +1159,7 @@ int main(int argc, char *argv[]) {
     PIN_AddDetachFunction(TerminateSimulationHandler, 0);
 
     // Start the benchmark program. This call never returns...
+    simulationStartTime = WallClock();
     PIN_StartProgram();
 
     return 0;
@@ -0,0 +1,1573 @@
+#ifndef BRANCH_PREDICTORS_H
+#define BRANCH_PREDICTORS_H
+
+// Branch predictor models shared by the pintool and the offline tools. The
+// pintool gets the integer types from pin.H, the offline tools, which are
+// built without Pin, define the few that the predictors use.
+//
+#ifdef PIN_CRT
+#include "pin.H"
+#else
+#include <stdint.h>
+typedef uintptr_t ADDRINT;
+typedef uint8_t UINT8;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+#endif
+
+#include "bp_plugin.h"
+#include <dlfcn.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <string>
+#include <vector>
+
+// Saturating counters, kept one per byte. A counter predicts taken when its
+// most significant bit is set.
+//
+inline UINT8 saturatorStrengthen(UINT8 saturator, UINT8 saturatorMax = 3) {
+    if (saturator < saturatorMax)
+        return saturator + 1;
+    else return saturator;
+}
+
+inline UINT8 saturatorWeaken(UINT8 saturator) {
+    if (saturator > 0)
+        return saturator - 1;
+    else return saturator;
+}
+
+// Number of index bits of a table with numberOfEntries entries
+//
+inline UINT32 IndexBits(UINT64 numberOfEntries) {
+    return log2(numberOfEntries);
+}
+
+inline ADDRINT LsbMask(UINT32 bits) {
+    return bits >= sizeof(ADDRINT) * 8 ? ~(ADDRINT)0 : ((ADDRINT)1 << bits) - 1;
+}
+
+// Fold a history longer than the index of a table onto the index bits
+//
+inline ADDRINT FoldHistory(ADDRINT history, UINT32 indexBits) {
+    ADDRINT folded = 0;
+    if (indexBits == 0)
+        return 0;
+    for (; history != 0; history = indexBits < sizeof(ADDRINT) * 8 ? history >> indexBits : 0)
+        folded ^= history & LsbMask(indexBits);
+    return folded;
+}
+
+// Parameters of a predictor besides its number of entries. Zero selects the
+// predictor's default. Setting a parameter a predictor type does not have is
+// an error, see UnsupportedPredictorParams().
+//
+struct BranchPredictorParams {
+    UINT32 historyLength;        // history bits, default log2(entries)
+    UINT32 counterBits;          // saturating counter width, default 2
+    UINT64 localHistoryEntries;  // local history table rows, default 128
+    UINT64 chooserEntries;       // tournament chooser, 2bc_gskew meta, bi_mode and
+                                 // yags choice or agree bias entries, default entries
+
+    BranchPredictorParams()
+        : historyLength(0), counterBits(0), localHistoryEntries(0),
+          chooserEntries(0) {}
+};
+
+// Bits of the parameters a predictor type takes
+//
+#define PREDICTOR_PARAM_HIST (1 << 0)
+#define PREDICTOR_PARAM_CTR (1 << 1)
+#define PREDICTOR_PARAM_LHR (1 << 2)
+#define PREDICTOR_PARAM_CHOOSER (1 << 3)
+
+// Return the bits of the parameters set, that is non-zero, in params
+//
+inline UINT32 PredictorParamsSet(const BranchPredictorParams &params) {
+    return (params.historyLength ? PREDICTOR_PARAM_HIST : 0) |
+           (params.counterBits ? PREDICTOR_PARAM_CTR : 0) |
+           (params.localHistoryEntries ? PREDICTOR_PARAM_LHR : 0) |
+           (params.chooserEntries ? PREDICTOR_PARAM_CHOOSER : 0);
+}
+
+/* Base branch predictor class */
+// You are highly recommended to follow this design when implementing your
+// branch predictors
+//
+class BranchPredictorInterface {
+  public:
+    virtual ~BranchPredictorInterface() {}
+
+    // This function returns a prediction for a branch instruction with address
+    // branchPC
+    virtual bool getPrediction(ADDRINT branchPC) = 0;
+
+    // This function updates branch predictor's history with outcome of branch
+    // instruction with address branchPC
+    virtual void train(ADDRINT branchPC, bool branchWasTaken) = 0;
+
+    // This function returns the number of bits of state the predictor would
+    // need in hardware
+    virtual UINT64 getStorageBits() = 0;
+
+    // This function returns the part of the predictor's table indices that
+    // only depends on the branch PC. Callers that see the same static branch
+    // many times, like the pintool, compute it once per static branch and
+    // call the ...ForKey() functions with it instead of the PC.
+    virtual ADDRINT getStaticKey(ADDRINT branchPC) { return branchPC; }
+
+    virtual bool getPredictionForKey(ADDRINT staticKey) {
+        return getPrediction(staticKey);
+    }
+
+    virtual void trainForKey(ADDRINT staticKey, bool branchWasTaken) {
+        train(staticKey, branchWasTaken);
+    }
+
+    // This function returns true when predicting and training a branch with
+    // this static key and outcome leaves the predictor unchanged, so that,
+    // while no other branch has the same key, its executions with that
+    // outcome all get the same prediction and can be counted in bulk
+    virtual bool isSteadyForKey(ADDRINT staticKey, bool branchWasTaken) {
+        return false;
+    }
+
+    // This function predicts and trains on count branches in order, given as
+    // records of (branchPC << 1) | branchWasTaken like in branch traces, and
+    // stores the prediction of every branch in predictions. Predictors that
+    // are cheaper to call once per batch override it.
+    virtual void trainBatch(const UINT64 *records, size_t count, UINT8 *predictions) {
+        for (size_t i = 0; i < count; i++) {
+            ADDRINT branchPC = records[i] >> 1;
+            predictions[i] = getPrediction(branchPC);
+            train(branchPC, records[i] & 1);
+        }
+    }
+};
+
+// This is a class which implements always taken branch predictor
+class AlwaysTakenBranchPredictor : public BranchPredictorInterface {
+  public:
+    AlwaysTakenBranchPredictor(
+        UINT64 numberOfEntries,
+        const BranchPredictorParams &params =
+            BranchPredictorParams()){}; // no entries here: always taken branch
+                                        // predictor is the simplest predictor
+    virtual bool getPrediction(ADDRINT branchPC) {
+        return true; // predict taken
+    }
+    virtual void train(ADDRINT branchPC, bool branchWasTaken) {
+    } // nothing to do here: always taken branch predictor does not have history
+    virtual UINT64 getStorageBits() { return 0; }
+    virtual bool isSteadyForKey(ADDRINT staticKey, bool branchWasTaken) {
+        return true;
+    }
+};
+
+
+class LocalBranchPredictor : public BranchPredictorInterface {
+  private:
+	std::vector<ADDRINT> LHR; 
+	std::vector<UINT8> PHT; 
+    ADDRINT lhrIndexMask;
+    ADDRINT lhrEntryLength;
+    ADDRINT lhrLsbMask;
+    UINT32 phtIndexBits;
+    UINT8 saturatorMax;
+
+    // the static key is the LHR index
+    int GetPhtIndex(ADDRINT lhrIndex){
+        ADDRINT phtIndex = FoldHistory(LHR[lhrIndex] & lhrLsbMask, phtIndexBits);
+        return phtIndex;
+    }
+
+  public:
+    LocalBranchPredictor(ADDRINT numberOfEntries,
+                         const BranchPredictorParams &params = BranchPredictorParams()){
+        LHR = std::vector<ADDRINT>(params.localHistoryEntries ? params.localHistoryEntries : 128);
+		PHT = std::vector<UINT8>(numberOfEntries);
+        lhrIndexMask = LsbMask(IndexBits(LHR.size()));
+
+        for (ADDRINT i = 0; i < LHR.size(); i += 1) {
+            LHR[i] = 0;
+        }
+
+        phtIndexBits = IndexBits(numberOfEntries);
+        lhrEntryLength = params.historyLength ? params.historyLength : phtIndexBits;
+        lhrLsbMask = LsbMask(lhrEntryLength);
+
+        saturatorMax = LsbMask(params.counterBits ? params.counterBits : 2);
+        for (ADDRINT i = 0; i < PHT.size(); i += 1) {
+            PHT[i] = saturatorMax;
+        }
+    }; 
+
+    virtual bool getPrediction(ADDRINT branchPC) { 
+        return getPredictionForKey(getStaticKey(branchPC));
+    } 
+
+    virtual void train(ADDRINT branchPC, bool branchWasTaken) {
+        trainForKey(getStaticKey(branchPC), branchWasTaken);
+    } 
+
+    virtual ADDRINT getStaticKey(ADDRINT branchPC) {
+        return branchPC & lhrIndexMask;
+    }
+
+    // Number of bits of the static keys
+    UINT32 getStaticKeyBits() { return IndexBits(LHR.size()); }
+
+    virtual bool getPredictionForKey(ADDRINT lhrIndex) { 
+        // PHT[LHR[branchPC]]
+        UINT8 saturator = PHT[GetPhtIndex(lhrIndex)];
+        return saturator > saturatorMax / 2;
+    } 
+
+    virtual void trainForKey(ADDRINT lhrIndex, bool branchWasTaken) {
+        
+        ADDRINT phtIndex = GetPhtIndex(lhrIndex);
+
+        // update local history
+        LHR[lhrIndex] = LHR[lhrIndex] << 1;
+        LHR[lhrIndex] += branchWasTaken;
+
+        // update saturator
+        UINT8 saturator = PHT[phtIndex];
+        if (branchWasTaken) { // strengthen
+            PHT[phtIndex] = saturatorStrengthen(saturator, saturatorMax); 
+        } else { // weaken
+            PHT[phtIndex] = saturatorWeaken(saturator); 
+        }
+
+    } 
+
+    virtual UINT64 getStorageBits() {
+        return LHR.size() * lhrEntryLength + PHT.size() * IndexBits(saturatorMax + 1);
+    }
+};
+
+// This is a class which implements a bimodal branch predictor: a table of
+// saturating counters indexed by the branch PC alone
+class BimodalBranchPredictor : public BranchPredictorInterface {
+  private:
+	std::vector<UINT8> PHT; 
+    ADDRINT lsbMask;
+    UINT8 saturatorMax;
+
+  public:
+    BimodalBranchPredictor(ADDRINT numberOfEntries,
+                           const BranchPredictorParams &params = BranchPredictorParams()){
+        saturatorMax = LsbMask(params.counterBits ? params.counterBits : 2);
+		PHT = std::vector<UINT8>(numberOfEntries, saturatorMax);
+        lsbMask = LsbMask(IndexBits(numberOfEntries));
+    }; 
+
+    virtual bool getPrediction(ADDRINT branchPC) { 
+        return getPredictionForKey(getStaticKey(branchPC));
+    } 
+
+    virtual void train(ADDRINT branchPC, bool branchWasTaken) {
+        trainForKey(getStaticKey(branchPC), branchWasTaken);
+    } 
+
+    // the static key is the PHT index
+    virtual ADDRINT getStaticKey(ADDRINT branchPC) {
+        return branchPC & lsbMask;
+    }
+
+    virtual bool getPredictionForKey(ADDRINT phtIndex) { 
+        // PHT[branchPC]
+        return PHT[phtIndex] > saturatorMax / 2;
+    } 
+
+    virtual void trainForKey(ADDRINT phtIndex, bool branchWasTaken) {
+        UINT8 saturator = PHT[phtIndex];
+        if (branchWasTaken) { // strengthen
+            PHT[phtIndex] = saturatorStrengthen(saturator, saturatorMax); 
+        } else { // weaken
+            PHT[phtIndex] = saturatorWeaken(saturator); 
+        }
+    } 
+
+    // a saturated counter stays saturated
+    virtual bool isSteadyForKey(ADDRINT phtIndex, bool branchWasTaken) {
+        return PHT[phtIndex] == (branchWasTaken ? saturatorMax : 0);
+    }
+
+    virtual UINT64 getStorageBits() {
+        return PHT.size() * IndexBits(saturatorMax + 1);
+    }
+};
+
+class GshareBranchPredictor : public BranchPredictorInterface {
+  private:
+	ADDRINT GHR; 
+	std::vector<UINT8> PHT; 
+    ADDRINT ghrEntryLength;
+    ADDRINT ghrLsbMask;
+    ADDRINT lsbMask;
+    UINT32 phtIndexBits;
+    UINT8 saturatorMax;
+
+    // the static key is the PC bits of the index
+    int GetPhtIndex(ADDRINT pclsb){
+        ADDRINT phtIndex = (pclsb ^ FoldHistory(GHR & ghrLsbMask, phtIndexBits)) & lsbMask;
+        return phtIndex;
+    }
+
+  public:
+    GshareBranchPredictor(ADDRINT numberOfEntries,
+                          const BranchPredictorParams &params = BranchPredictorParams()){
+        GHR = 0;
+		PHT = std::vector<UINT8>(numberOfEntries);
+        saturatorMax = LsbMask(params.counterBits ? params.counterBits : 2);
+        for (ADDRINT i = 0; i < PHT.size(); i += 1) {
+            PHT[i] = saturatorMax;
+        }
+
+        phtIndexBits = IndexBits(numberOfEntries);
+        lsbMask = LsbMask(phtIndexBits);
+        ghrEntryLength = params.historyLength ? params.historyLength : phtIndexBits;
+        ghrLsbMask = LsbMask(ghrEntryLength);
+    }; 
+
+    virtual bool getPrediction(ADDRINT branchPC) { 
+        return getPredictionForKey(getStaticKey(branchPC));
+    } 
+
+    virtual void train(ADDRINT branchPC, bool branchWasTaken) {
+        trainForKey(getStaticKey(branchPC), branchWasTaken);
+    } 
+
+    virtual ADDRINT getStaticKey(ADDRINT branchPC) {
+        return branchPC & lsbMask;
+    }
+
+    // Number of bits of the static keys
+    UINT32 getStaticKeyBits() { return phtIndexBits; }
+
+    virtual bool getPredictionForKey(ADDRINT pclsb) { 
+        // PHT[ GHR XOR branchPC]
+        UINT8 saturator = PHT[GetPhtIndex(pclsb)];
+        return saturator > saturatorMax / 2;
+    } 
+
+    virtual void trainForKey(ADDRINT pclsb, bool branchWasTaken) {
+
+        ADDRINT phtIndex = GetPhtIndex(pclsb);
+
+        // update global history
+        GHR = GHR << 1;
+        GHR += branchWasTaken;
+
+        // // update saturator
+        UINT8 saturator = PHT[phtIndex];
+        if (branchWasTaken) { // strengthen
+            PHT[phtIndex] = saturatorStrengthen(saturator, saturatorMax); 
+
+        } else { // weaken
+            PHT[phtIndex] = saturatorWeaken(saturator); 
+        }
+
+    } 
+
+    virtual UINT64 getStorageBits() {
+        return ghrEntryLength + PHT.size() * IndexBits(saturatorMax + 1);
+    }
+};
+
+
+class TournamentBranchPredictor : public BranchPredictorInterface {
+  private:
+	std::vector<UINT8> PHT; 
+    ADDRINT lsbMask;
+    LocalBranchPredictor localPredictor;
+    GshareBranchPredictor gsharePredictor;
+
+    // Static keys pack the chooser index, the local key and the gshare key,
+    // unless they do not fit together and the key is the PC
+    bool packedKeys;
+    UINT32 chooserBits;
+    UINT32 localKeyBits;
+
+    void UnpackKey(ADDRINT staticKey, ADDRINT &phtIndex, ADDRINT &localKey,
+                   ADDRINT &gshareKey) {
+        phtIndex = staticKey & lsbMask;
+        if (packedKeys) {
+            localKey = (staticKey >> chooserBits) & LsbMask(localKeyBits);
+            gshareKey = staticKey >> (chooserBits + localKeyBits);
+        } else {
+            localKey = localPredictor.getStaticKey(staticKey);
+            gshareKey = gsharePredictor.getStaticKey(staticKey);
+        }
+    }
+
+  public:
+    TournamentBranchPredictor(ADDRINT numberOfEntries,
+                              const BranchPredictorParams &params = BranchPredictorParams())
+        : localPredictor(numberOfEntries, params),
+          gsharePredictor(numberOfEntries, params) {
+		PHT = std::vector<UINT8>(params.chooserEntries ? params.chooserEntries : numberOfEntries);
+        for (ADDRINT i = 0; i < PHT.size(); i += 1) {
+            PHT[i] = 0b11;
+        }
+
+        chooserBits = IndexBits(PHT.size());
+        lsbMask = LsbMask(chooserBits);
+        localKeyBits = localPredictor.getStaticKeyBits();
+        packedKeys = chooserBits + localKeyBits + gsharePredictor.getStaticKeyBits() <
+                     sizeof(ADDRINT) * 8;
+    }; 
+
+    virtual bool getPrediction(ADDRINT branchPC) { 
+        return getPredictionForKey(getStaticKey(branchPC));
+    } 
+
+    virtual void train(ADDRINT branchPC, bool branchWasTaken) {
+        trainForKey(getStaticKey(branchPC), branchWasTaken);
+    } 
+
+    virtual ADDRINT getStaticKey(ADDRINT branchPC) {
+        if (!packedKeys)
+            return branchPC;
+        return (branchPC & lsbMask) |
+               (localPredictor.getStaticKey(branchPC) << chooserBits) |
+               (gsharePredictor.getStaticKey(branchPC) << (chooserBits + localKeyBits));
+    }
+
+    virtual bool getPredictionForKey(ADDRINT staticKey) { 
+        ADDRINT phtIndex, localKey, gshareKey;
+        UnpackKey(staticKey, phtIndex, localKey, gshareKey);
+
+        // PHT[ branchPC]
+        UINT8 saturator = PHT[phtIndex];
+        if (saturator >> 1 == 1){ // use gshare
+            return gsharePredictor.getPredictionForKey(gshareKey);
+        } else { // use local
+            return localPredictor.getPredictionForKey(localKey);
+        }
+    } 
+
+    virtual void trainForKey(ADDRINT staticKey, bool branchWasTaken) {
+
+        ADDRINT phtIndex, localKey, gshareKey;
+        UnpackKey(staticKey, phtIndex, localKey, gshareKey);
+        UINT8 saturator = PHT[phtIndex];
+
+        // correct prediction -> meta-predictor entry is strengthened
+        // mis-prediction && the unselected predictor correct -> meta-predictor entry is weakened
+        // mis-prediction && both predictors wrong -> do not update meta-predictor
+
+        // update saturator
+
+        bool isTournamentCorrect = true;
+        bool isLocalCorrect = localPredictor.getPredictionForKey(localKey) == branchWasTaken;
+        bool isGshareCorrect = gsharePredictor.getPredictionForKey(gshareKey) == branchWasTaken;
+
+        if (saturator >> 1 == 0){ // selected local
+            if (isLocalCorrect) { // if local is correct
+                PHT[phtIndex] = saturatorWeaken(saturator); // strengthen local
+            } else {
+                isTournamentCorrect = false;
+            }
+        } else { // selected gshare
+            if (isGshareCorrect) { // if gshare is correct
+                PHT[phtIndex] = saturatorStrengthen(saturator); // strengthen gshare
+            } else {
+                isTournamentCorrect = false; 
+            }
+        }
+
+        if (!isTournamentCorrect) { // if prediction was wrong
+            if (isLocalCorrect) { // if local is correct
+                PHT[phtIndex] = saturatorWeaken(saturator); // strengthen local
+            } else if (isGshareCorrect) { // if gshare is correct
+                PHT[phtIndex] = saturatorStrengthen(saturator); // strengthen gshare
+            } // else do nothing
+        }
+
+        // train gshare and local
+        gsharePredictor.trainForKey(gshareKey, branchWasTaken);
+        localPredictor.trainForKey(localKey, branchWasTaken);
+
+    } 
+
+    virtual UINT64 getStorageBits() {
+        return PHT.size() * 2 + localPredictor.getStorageBits() +
+               gsharePredictor.getStorageBits();
+    }
+};
+
+// Tournament predictor with an interleaved table layout. The chooser counter
+// and the local history of a branch are indexed by the same PC bits and live
+// in one row, so the PC-indexed state of a branch is a single cache line away.
+// The local and gshare counters are byte-sized and owned by value, so there
+// is no pointer chase to reach a sub-predictor.
+//
+// Unlike TournamentBranchPredictor, the local history table has one row per
+// chooser entry instead of a fixed 128 rows, so the two layouts only give
+// identical results for 128 entries.
+class InterleavedTournamentBranchPredictor : public BranchPredictorInterface {
+  private:
+    struct TournamentRow {
+        UINT32 localHistory;
+        UINT8 chooser;
+    };
+
+    std::vector<TournamentRow> rows;
+    std::vector<UINT8> localPHT;
+    std::vector<UINT8> gsharePHT;
+    ADDRINT GHR;
+    ADDRINT lsbMask;
+
+    bool GetLocalPrediction(const TournamentRow &row){
+        return localPHT[row.localHistory & lsbMask] >> 1;
+    }
+
+    // the static key is the row index
+    bool GetGsharePrediction(ADDRINT rowIndex){
+        return gsharePHT[(rowIndex ^ GHR) & lsbMask] >> 1;
+    }
+
+  public:
+    InterleavedTournamentBranchPredictor(ADDRINT numberOfEntries,
+                                         const BranchPredictorParams &params = BranchPredictorParams()){
+        TournamentRow initialRow = {0, 0b11};
+        rows = std::vector<TournamentRow>(numberOfEntries, initialRow);
+        localPHT = std::vector<UINT8>(numberOfEntries, 0b11);
+        gsharePHT = std::vector<UINT8>(numberOfEntries, 0b11);
+        GHR = 0;
+        lsbMask = LsbMask(IndexBits(numberOfEntries));
+    };
+
+    virtual bool getPrediction(ADDRINT branchPC) {
+        return getPredictionForKey(getStaticKey(branchPC));
+    }
+
+    virtual void train(ADDRINT branchPC, bool branchWasTaken) {
+        trainForKey(getStaticKey(branchPC), branchWasTaken);
+    }
+
+    virtual ADDRINT getStaticKey(ADDRINT branchPC) {
+        return branchPC & lsbMask;
+    }
+
+    virtual bool getPredictionForKey(ADDRINT rowIndex) {
+        const TournamentRow &row = rows[rowIndex];
+        if (row.chooser >> 1){ // use gshare
+            return GetGsharePrediction(rowIndex);
+        } else { // use local
+            return GetLocalPrediction(row);
+        }
+    }
+
+    virtual void trainForKey(ADDRINT rowIndex, bool branchWasTaken) {
+
+        TournamentRow &row = rows[rowIndex];
+        ADDRINT localIndex = row.localHistory & lsbMask;
+        ADDRINT gshareIndex = (rowIndex ^ GHR) & lsbMask;
+        UINT8 saturator = row.chooser;
+
+        // same meta-predictor policy as TournamentBranchPredictor
+        bool isTournamentCorrect = true;
+        bool isLocalCorrect = (localPHT[localIndex] >> 1) == branchWasTaken;
+        bool isGshareCorrect = (gsharePHT[gshareIndex] >> 1) == branchWasTaken;
+
+        if ((saturator >> 1) == 0){ // selected local
+            if (isLocalCorrect) {
+                row.chooser = saturatorWeaken(saturator); // strengthen local
+            } else {
+                isTournamentCorrect = false;
+            }
+        } else { // selected gshare
+            if (isGshareCorrect) {
+                row.chooser = saturatorStrengthen(saturator); // strengthen gshare
+            } else {
+                isTournamentCorrect = false;
+            }
+        }
+
+        if (!isTournamentCorrect) { // if prediction was wrong
+            if (isLocalCorrect) {
+                row.chooser = saturatorWeaken(saturator); // strengthen local
+            } else if (isGshareCorrect) {
+                row.chooser = saturatorStrengthen(saturator); // strengthen gshare
+            } // else do nothing
+        }
+
+        // train gshare and local
+        GHR = (GHR << 1) + branchWasTaken;
+        row.localHistory = (row.localHistory << 1) + branchWasTaken;
+        if (branchWasTaken) {
+            gsharePHT[gshareIndex] = saturatorStrengthen(gsharePHT[gshareIndex]);
+            localPHT[localIndex] = saturatorStrengthen(localPHT[localIndex]);
+        } else {
+            gsharePHT[gshareIndex] = saturatorWeaken(gsharePHT[gshareIndex]);
+            localPHT[localIndex] = saturatorWeaken(localPHT[localIndex]);
+        }
+
+    }
+
+    virtual UINT64 getStorageBits() {
+        UINT64 historyBits = IndexBits(rows.size());
+        return rows.size() * (historyBits + 2) + localPHT.size() * 2 +
+               gsharePHT.size() * 2 + historyBits;
+    }
+};
+
+
+// Saturating counters packed into 64-bit words, the storage of the multi-bank
+// de-aliased predictors below. Every counter takes a power of two slot of at
+// least counterBits bits, so that finding it is a shift and a mask; the
+// storage only counts the counterBits bits. A counter predicts taken when its
+// most significant bit is set.
+//
+class PackedCounterTable {
+  private:
+    std::vector<UINT64> words;
+    ADDRINT indexMask;
+    UINT32 indexBits;
+    UINT32 counterBits;
+    UINT32 slotShift;       // log2 of the slot bits
+    UINT32 slotsShift;      // log2 of the slots per word
+    UINT8 saturatorMax;
+
+  public:
+    PackedCounterTable()
+        : indexMask(0), indexBits(0), counterBits(2), slotShift(1), slotsShift(5),
+          saturatorMax(3) {}
+
+    // numberOfEntries counters of counterBits (default 2) bits, all set to
+    // initialValue
+    void Init(UINT64 numberOfEntries, UINT32 bits, UINT8 initialValue) {
+        counterBits = bits ? bits : 2;
+        for (slotShift = 0; (1U << slotShift) < counterBits; slotShift++)
+            ;
+        slotsShift = 6 - slotShift;
+        saturatorMax = LsbMask(counterBits);
+        indexBits = IndexBits(numberOfEntries);
+        indexMask = LsbMask(indexBits);
+        words.assign(((indexMask + 1) >> slotsShift) + 1, 0);
+        for (ADDRINT i = 0; i <= indexMask; i += 1)
+            Set(i, initialValue);
+    }
+
+    UINT32 IndexBitCount() const { return indexBits; }
+    ADDRINT IndexMask() const { return indexMask; }
+    UINT8 WeaklyTaken() const { return saturatorMax / 2 + 1; }
+    UINT8 WeaklyNotTaken() const { return saturatorMax / 2; }
+
+    UINT8 Get(ADDRINT index) const {
+        index &= indexMask;
+        UINT32 shift = (index & LsbMask(slotsShift)) << slotShift;
+        return (words[index >> slotsShift] >> shift) & saturatorMax;
+    }
+
+    void Set(ADDRINT index, UINT8 value) {
+        index &= indexMask;
+        UINT32 shift = (index & LsbMask(slotsShift)) << slotShift;
+        UINT64 &word = words[index >> slotsShift];
+        word = (word & ~((UINT64)saturatorMax << shift)) | ((UINT64)value << shift);
+    }
+
+    bool Predict(ADDRINT index) const { return Get(index) > saturatorMax / 2; }
+
+    void Train(ADDRINT index, bool branchWasTaken) {
+        UINT8 saturator = Get(index);
+        Set(index, branchWasTaken ? saturatorStrengthen(saturator, saturatorMax)
+                                  : saturatorWeaken(saturator));
+    }
+
+    UINT64 getStorageBits() const { return (indexMask + 1) * counterBits; }
+};
+
+// Skewing function H of Michaud, Seznec and Uhlig over bits-bit values: a
+// shift right by one whose new top bit is the xor of the old end bits, and
+// its inverse
+//
+inline ADDRINT SkewH(ADDRINT value, UINT32 bits) {
+    if (bits < 2)
+        return value;
+    value &= LsbMask(bits);
+    return (value >> 1) | (((value ^ (value >> (bits - 1))) & 1) << (bits - 1));
+}
+
+inline ADDRINT SkewHInverse(ADDRINT value, UINT32 bits) {
+    if (bits < 2)
+        return value;
+    value &= LsbMask(bits);
+    return ((value << 1) & LsbMask(bits)) |
+           (((value >> (bits - 1)) ^ (value >> (bits - 2))) & 1);
+}
+
+// Index of bank 0 to 3 of a skewed predictor for the address bits and folded
+// history bits of a branch. Two branches that share an entry in one bank
+// almost never share one in another.
+//
+inline ADDRINT SkewIndex(UINT32 bank, ADDRINT address, ADDRINT history, UINT32 bits) {
+    address &= LsbMask(bits);
+    history &= LsbMask(bits);
+    switch (bank) {
+    case 0:
+        return SkewH(address, bits) ^ SkewHInverse(history, bits) ^ history;
+    case 1:
+        return SkewH(address, bits) ^ SkewHInverse(history, bits) ^ address;
+    case 2:
+        return SkewHInverse(address, bits) ^ SkewH(history, bits) ^ history;
+    default:
+        return SkewHInverse(address, bits) ^ SkewH(history, bits) ^ address;
+    }
+}
+
+// Global history shared by the de-aliased predictors
+//
+struct GlobalHistory {
+    ADDRINT GHR;
+    UINT32 length;
+
+    void Init(UINT32 historyLength) {
+        GHR = 0;
+        length = historyLength;
+    }
+
+    // The history folded onto bits bits
+    ADDRINT Folded(UINT32 bits) const {
+        return FoldHistory(GHR & LsbMask(length), bits);
+    }
+
+    void Update(bool branchWasTaken) { GHR = (GHR << 1) + branchWasTaken; }
+};
+
+// gskew: three banks indexed by different skewing functions of the address
+// and the history, predicting by majority vote. Partial update: on a correct
+// prediction only the banks that voted for it are strengthened, so a bank
+// that holds another branch's counter is left alone.
+//
+class GskewBranchPredictor : public BranchPredictorInterface {
+  private:
+    PackedCounterTable banks[3];
+    GlobalHistory history;
+
+    void GetIndices(ADDRINT branchPC, ADDRINT indices[3]) {
+        UINT32 bits = banks[0].IndexBitCount();
+        ADDRINT folded = history.Folded(bits);
+        for (int i = 0; i < 3; i++)
+            indices[i] = SkewIndex(i, branchPC, folded, bits);
+    }
+
+  public:
+    GskewBranchPredictor(UINT64 numberOfEntries,
+                         const BranchPredictorParams &params = BranchPredictorParams()) {
+        UINT8 saturatorMax = LsbMask(params.counterBits ? params.counterBits : 2);
+        for (int i = 0; i < 3; i++)
+            banks[i].Init(numberOfEntries, params.counterBits, saturatorMax);
+        history.Init(params.historyLength ? params.historyLength : IndexBits(numberOfEntries));
+    }
+
+    virtual bool getPrediction(ADDRINT branchPC) {
+        ADDRINT indices[3];
+        GetIndices(branchPC, indices);
+        return banks[0].Predict(indices[0]) + banks[1].Predict(indices[1]) +
+                   banks[2].Predict(indices[2]) >= 2;
+    }
+
+    virtual void train(ADDRINT branchPC, bool branchWasTaken) {
+        ADDRINT indices[3];
+        bool votes[3];
+        GetIndices(branchPC, indices);
+        for (int i = 0; i < 3; i++)
+            votes[i] = banks[i].Predict(indices[i]);
+        bool prediction = votes[0] + votes[1] + votes[2] >= 2;
+
+        for (int i = 0; i < 3; i++) {
+            if (prediction != branchWasTaken || votes[i] == branchWasTaken)
+                banks[i].Train(indices[i], branchWasTaken);
+        }
+        history.Update(branchWasTaken);
+    }
+
+    virtual UINT64 getStorageBits() {
+        return history.length + 3 * banks[0].getStorageBits();
+    }
+};
+
+// 2bc-gskew of the Alpha EV8: a bimodal bank BIM and two skewed banks G0 and
+// G1 vote as in gskew, and a meta bank indexed with the history chooses
+// between the vote and BIM alone. chooser= sets the meta bank size.
+//
+class TwoBcGskewBranchPredictor : public BranchPredictorInterface {
+  private:
+    PackedCounterTable BIM;
+    PackedCounterTable G0;
+    PackedCounterTable G1;
+    PackedCounterTable META;
+    GlobalHistory history;
+
+    struct Lookup {
+        ADDRINT bimIndex, g0Index, g1Index, metaIndex;
+        bool bim, g0, g1, vote, useVote;
+    };
+
+    void DoLookup(ADDRINT branchPC, Lookup &lookup) {
+        UINT32 bits = G0.IndexBitCount();
+        ADDRINT folded = history.Folded(bits);
+        lookup.bimIndex = branchPC & BIM.IndexMask();
+        lookup.g0Index = SkewIndex(1, branchPC, folded, bits);
+        lookup.g1Index = SkewIndex(2, branchPC, folded, bits);
+        UINT32 metaBits = META.IndexBitCount();
+        lookup.metaIndex = SkewIndex(3, branchPC, history.Folded(metaBits), metaBits);
+
+        lookup.bim = BIM.Predict(lookup.bimIndex);
+        lookup.g0 = G0.Predict(lookup.g0Index);
+        lookup.g1 = G1.Predict(lookup.g1Index);
+        lookup.vote = lookup.bim + lookup.g0 + lookup.g1 >= 2;
+        lookup.useVote = META.Predict(lookup.metaIndex);
+    }
+
+  public:
+    TwoBcGskewBranchPredictor(UINT64 numberOfEntries,
+                              const BranchPredictorParams &params = BranchPredictorParams()) {
+        UINT8 saturatorMax = LsbMask(params.counterBits ? params.counterBits : 2);
+        BIM.Init(numberOfEntries, params.counterBits, saturatorMax);
+        G0.Init(numberOfEntries, params.counterBits, saturatorMax);
+        G1.Init(numberOfEntries, params.counterBits, saturatorMax);
+        // weakly choosing BIM alone
+        META.Init(params.chooserEntries ? params.chooserEntries : numberOfEntries,
+                  params.counterBits, saturatorMax / 2);
+        history.Init(params.historyLength ? params.historyLength : IndexBits(numberOfEntries));
+    }
+
+    virtual bool getPrediction(ADDRINT branchPC) {
+        Lookup lookup;
+        DoLookup(branchPC, lookup);
+        return lookup.useVote ? lookup.vote : lookup.bim;
+    }
+
+    // The EV8 update policy: the meta bank learns which side was right when
+    // they disagree; on a misprediction all three voting banks are trained,
+    // on a correct prediction only the banks that gave it are strengthened
+    virtual void train(ADDRINT branchPC, bool branchWasTaken) {
+        Lookup lookup;
+        DoLookup(branchPC, lookup);
+        bool prediction = lookup.useVote ? lookup.vote : lookup.bim;
+
+        if (lookup.vote != lookup.bim)
+            META.Train(lookup.metaIndex, lookup.vote == branchWasTaken);
+
+        if (prediction != branchWasTaken) {
+            BIM.Train(lookup.bimIndex, branchWasTaken);
+            G0.Train(lookup.g0Index, branchWasTaken);
+            G1.Train(lookup.g1Index, branchWasTaken);
+        } else if (!lookup.useVote) {
+            BIM.Train(lookup.bimIndex, branchWasTaken);
+        } else {
+            if (lookup.bim == branchWasTaken)
+                BIM.Train(lookup.bimIndex, branchWasTaken);
+            if (lookup.g0 == branchWasTaken)
+                G0.Train(lookup.g0Index, branchWasTaken);
+            if (lookup.g1 == branchWasTaken)
+                G1.Train(lookup.g1Index, branchWasTaken);
+        }
+        history.Update(branchWasTaken);
+    }
+
+    virtual UINT64 getStorageBits() {
+        return history.length + BIM.getStorageBits() + G0.getStorageBits() +
+               G1.getStorageBits() + META.getStorageBits();
+    }
+};
+
+// Bi-mode: a choice table indexed by the PC picks one of two gshare-indexed
+// direction banks, one for mostly taken and one for mostly not taken
+// branches, so that branches of opposite bias do not destroy each other's
+// counters. chooser= sets the choice table size.
+//
+class BiModeBranchPredictor : public BranchPredictorInterface {
+  private:
+    PackedCounterTable choice;
+    PackedCounterTable direction[2];  // [0] not taken, [1] taken biased
+    GlobalHistory history;
+
+    ADDRINT GetDirectionIndex(ADDRINT branchPC) {
+        UINT32 bits = direction[0].IndexBitCount();
+        return (branchPC ^ history.Folded(bits)) & direction[0].IndexMask();
+    }
+
+  public:
+    BiModeBranchPredictor(UINT64 numberOfEntries,
+                          const BranchPredictorParams &params = BranchPredictorParams()) {
+        UINT8 saturatorMax = LsbMask(params.counterBits ? params.counterBits : 2);
+        choice.Init(params.chooserEntries ? params.chooserEntries : numberOfEntries,
+                    params.counterBits, saturatorMax / 2 + 1);
+        direction[0].Init(numberOfEntries, params.counterBits, saturatorMax / 2);
+        direction[1].Init(numberOfEntries, params.counterBits, saturatorMax / 2 + 1);
+        history.Init(params.historyLength ? params.historyLength : IndexBits(numberOfEntries));
+    }
+
+    virtual bool getPrediction(ADDRINT branchPC) {
+        return direction[choice.Predict(branchPC)].Predict(GetDirectionIndex(branchPC));
+    }
+
+    // Only the chosen direction bank is trained. The choice table is not
+    // trained when it was wrong but the chosen bank still predicted right.
+    virtual void train(ADDRINT branchPC, bool branchWasTaken) {
+        bool choiceTaken = choice.Predict(branchPC);
+        ADDRINT index = GetDirectionIndex(branchPC);
+        bool prediction = direction[choiceTaken].Predict(index);
+
+        direction[choiceTaken].Train(index, branchWasTaken);
+        if (choiceTaken == branchWasTaken || prediction != branchWasTaken)
+            choice.Train(branchPC, branchWasTaken);
+        history.Update(branchWasTaken);
+    }
+
+    virtual UINT64 getStorageBits() {
+        return history.length + choice.getStorageBits() +
+               direction[0].getStorageBits() + direction[1].getStorageBits();
+    }
+};
+
+// Tag width of the YAGS caches
+//
+#define YAGS_TAG_BITS 8
+
+// YAGS: a choice table indexed by the PC gives the bias of a branch, and two
+// small tagged caches indexed like gshare only hold the exceptions to it, the
+// taken cache for branches biased not taken and the not taken cache for
+// branches biased taken. chooser= sets the choice table size.
+//
+class YagsBranchPredictor : public BranchPredictorInterface {
+  private:
+    PackedCounterTable choice;
+    PackedCounterTable caches[2];       // [0] not taken, [1] taken cache
+    std::vector<UINT16> tags[2];
+    GlobalHistory history;
+
+    struct Lookup {
+        ADDRINT index;
+        UINT16 tag;
+        bool choiceTaken;
+        bool hit;
+        bool prediction;
+    };
+
+    // The exceptions to a taken bias are in the not taken cache and the other
+    // way round
+    void DoLookup(ADDRINT branchPC, Lookup &lookup) {
+        UINT32 bits = caches[0].IndexBitCount();
+        lookup.index = (branchPC ^ history.Folded(bits)) & caches[0].IndexMask();
+        lookup.tag = branchPC & LsbMask(YAGS_TAG_BITS);
+        lookup.choiceTaken = choice.Predict(branchPC);
+        int cache = !lookup.choiceTaken;
+        lookup.hit = tags[cache][lookup.index] == lookup.tag;
+        lookup.prediction = lookup.hit ? caches[cache].Predict(lookup.index)
+                                       : lookup.choiceTaken;
+    }
+
+  public:
+    YagsBranchPredictor(UINT64 numberOfEntries,
+                        const BranchPredictorParams &params = BranchPredictorParams()) {
+        UINT8 saturatorMax = LsbMask(params.counterBits ? params.counterBits : 2);
+        choice.Init(params.chooserEntries ? params.chooserEntries : numberOfEntries,
+                    params.counterBits, saturatorMax / 2 + 1);
+        for (int i = 0; i < 2; i++) {
+            caches[i].Init(numberOfEntries, params.counterBits, 0);
+            // no tag matches an entry until it is allocated
+            tags[i] = std::vector<UINT16>(caches[i].IndexMask() + 1,
+                                          LsbMask(YAGS_TAG_BITS) + 1);
+        }
+        history.Init(params.historyLength ? params.historyLength : IndexBits(numberOfEntries));
+    }
+
+    virtual bool getPrediction(ADDRINT branchPC) {
+        Lookup lookup;
+        DoLookup(branchPC, lookup);
+        return lookup.prediction;
+    }
+
+    // A cache entry is trained on a hit, and allocated for the branch when the
+    // choice table alone mispredicted it. The choice table is trained as in
+    // bi-mode.
+    virtual void train(ADDRINT branchPC, bool branchWasTaken) {
+        Lookup lookup;
+        DoLookup(branchPC, lookup);
+        int cache = !lookup.choiceTaken;
+
+        if (lookup.hit) {
+            caches[cache].Train(lookup.index, branchWasTaken);
+        } else if (lookup.choiceTaken != branchWasTaken) {
+            tags[cache][lookup.index] = lookup.tag;
+            caches[cache].Set(lookup.index, branchWasTaken ? caches[cache].WeaklyTaken()
+                                                           : caches[cache].WeaklyNotTaken());
+        }
+        if (lookup.choiceTaken == branchWasTaken || lookup.prediction != branchWasTaken)
+            choice.Train(branchPC, branchWasTaken);
+        history.Update(branchWasTaken);
+    }
+
+    virtual UINT64 getStorageBits() {
+        return history.length + choice.getStorageBits() +
+               2 * (caches[0].getStorageBits() + tags[0].size() * YAGS_TAG_BITS);
+    }
+};
+
+// Agree: a bias bit per branch, set by its first outcome, and a gshare-indexed
+// table of counters predicting whether the branch agrees with its bias, so
+// that two branches sharing a counter usually push it the same way. chooser=
+// sets the bias table size, which stands for the bias bits in the BTB.
+//
+class AgreeBranchPredictor : public BranchPredictorInterface {
+  private:
+    PackedCounterTable PHT;
+    std::vector<UINT8> bias;  // 0 not taken, 1 taken, 2 not set yet
+    ADDRINT biasIndexMask;
+    GlobalHistory history;
+
+    ADDRINT GetPhtIndex(ADDRINT branchPC) {
+        UINT32 bits = PHT.IndexBitCount();
+        return (branchPC ^ history.Folded(bits)) & PHT.IndexMask();
+    }
+
+  public:
+    AgreeBranchPredictor(UINT64 numberOfEntries,
+                         const BranchPredictorParams &params = BranchPredictorParams()) {
+        UINT8 saturatorMax = LsbMask(params.counterBits ? params.counterBits : 2);
+        PHT.Init(numberOfEntries, params.counterBits, saturatorMax);
+        UINT64 biasEntries = params.chooserEntries ? params.chooserEntries : numberOfEntries;
+        biasIndexMask = LsbMask(IndexBits(biasEntries));
+        bias = std::vector<UINT8>(biasIndexMask + 1, 2);
+        history.Init(params.historyLength ? params.historyLength : IndexBits(numberOfEntries));
+    }
+
+    // A branch without a bias bit yet is assumed biased taken
+    virtual bool getPrediction(ADDRINT branchPC) {
+        bool biasTaken = bias[branchPC & biasIndexMask] != 0;
+        return PHT.Predict(GetPhtIndex(branchPC)) == biasTaken;
+    }
+
+    virtual void train(ADDRINT branchPC, bool branchWasTaken) {
+        UINT8 &biasBit = bias[branchPC & biasIndexMask];
+        if (biasBit == 2)
+            biasBit = branchWasTaken;
+        PHT.Train(GetPhtIndex(branchPC), branchWasTaken == (biasBit != 0));
+        history.Update(branchWasTaken);
+    }
+
+    // A valid and a bias bit per bias table entry
+    virtual UINT64 getStorageBits() {
+        return history.length + PHT.getStorageBits() + 2 * bias.size();
+    }
+};
+
+// Every predictor type: its name, the parameters it takes, and the size,
+// alignment and constructor of its class, so that a predictor can also be
+// built in memory owned by another one
+//
+struct BranchPredictorType {
+    const char *name;
+    UINT32 params;  // PREDICTOR_PARAM_* bits
+    size_t size;
+    size_t alignment;
+    BranchPredictorInterface *(*construct)(void *memory, UINT64 numberOfEntries,
+                                           const BranchPredictorParams &params);
+};
+
+// Build a Predictor in memory, or on the heap if memory is NULL
+template <class Predictor>
+inline BranchPredictorInterface *ConstructBranchPredictor(void *memory,
+                                                          UINT64 numberOfEntries,
+                                                          const BranchPredictorParams &params) {
+    if (memory == NULL)
+        return new Predictor(numberOfEntries, params);
+    return new (memory) Predictor(numberOfEntries, params);
+}
+
+#define BRANCH_PREDICTOR_TYPE(name, params, Predictor)                         \
+    {name, params, sizeof(Predictor), alignof(Predictor),                      \
+     ConstructBranchPredictor<Predictor>}
+
+// Return the predictor type with the given name, or NULL if there is none
+//
+inline const BranchPredictorType *FindBranchPredictorType(const std::string &type) {
+    const UINT32 HISTORY_AND_COUNTER = PREDICTOR_PARAM_HIST | PREDICTOR_PARAM_CTR;
+    static const BranchPredictorType types[] = {
+        BRANCH_PREDICTOR_TYPE("always_taken", 0, AlwaysTakenBranchPredictor),
+        BRANCH_PREDICTOR_TYPE("bimodal", PREDICTOR_PARAM_CTR, BimodalBranchPredictor),
+        BRANCH_PREDICTOR_TYPE("local", HISTORY_AND_COUNTER | PREDICTOR_PARAM_LHR,
+                              LocalBranchPredictor),
+        BRANCH_PREDICTOR_TYPE("gshare", HISTORY_AND_COUNTER, GshareBranchPredictor),
+        BRANCH_PREDICTOR_TYPE("tournament",
+                              HISTORY_AND_COUNTER | PREDICTOR_PARAM_LHR |
+                                  PREDICTOR_PARAM_CHOOSER,
+                              TournamentBranchPredictor),
+        BRANCH_PREDICTOR_TYPE("tournament_interleaved", 0,
+                              InterleavedTournamentBranchPredictor),
+        BRANCH_PREDICTOR_TYPE("gskew", HISTORY_AND_COUNTER, GskewBranchPredictor),
+        BRANCH_PREDICTOR_TYPE("2bc_gskew", HISTORY_AND_COUNTER | PREDICTOR_PARAM_CHOOSER,
+                              TwoBcGskewBranchPredictor),
+        BRANCH_PREDICTOR_TYPE("bi_mode", HISTORY_AND_COUNTER | PREDICTOR_PARAM_CHOOSER,
+                              BiModeBranchPredictor),
+        BRANCH_PREDICTOR_TYPE("yags", HISTORY_AND_COUNTER | PREDICTOR_PARAM_CHOOSER,
+                              YagsBranchPredictor),
+        BRANCH_PREDICTOR_TYPE("agree", HISTORY_AND_COUNTER | PREDICTOR_PARAM_CHOOSER,
+                              AgreeBranchPredictor),
+    };
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (type == types[i].name)
+            return &types[i];
+    }
+    return NULL;
+}
+
+#undef BRANCH_PREDICTOR_TYPE
+
+// Parse a predictor spec of the form "type:entries[,param=value...]", e.g.
+// "gshare:4096" or "tournament:4096,hist=16,ctr=3,lhr=1024,chooser=2048"
+//
+inline bool ParsePredictorSpec(const std::string &spec, std::string &type,
+                               UINT64 &numberOfEntries,
+                               BranchPredictorParams &params) {
+    size_t colon = spec.find(':');
+    if (colon == std::string::npos)
+        return false;
+    type = spec.substr(0, colon);
+    char *end;
+    numberOfEntries = strtoull(spec.c_str() + colon + 1, &end, 0);
+    if (numberOfEntries == 0)
+        return false;
+
+    params = BranchPredictorParams();
+    while (*end == ',') {
+        const char *name = end + 1;
+        const char *equals = strchr(name, '=');
+        if (equals == NULL)
+            return false;
+        std::string param(name, equals - name);
+        UINT64 value = strtoull(equals + 1, &end, 0);
+        if (value == 0 || end == equals + 1)
+            return false;
+        if (param == "hist" && value <= 64)
+            params.historyLength = value;
+        else if (param == "ctr" && value <= 8)
+            params.counterBits = value;
+        else if (param == "lhr")
+            params.localHistoryEntries = value;
+        else if (param == "chooser")
+            params.chooserEntries = value;
+        else
+            return false;
+    }
+    return *end == '\0';
+}
+
+// A predictor of a plugin loaded from a shared object, see bp_plugin.h
+//
+class PluginBranchPredictor : public BranchPredictorInterface {
+  private:
+    const bp_plugin *plugin;
+    bp_predictor *predictor;
+
+    PluginBranchPredictor(const PluginBranchPredictor &);
+    PluginBranchPredictor &operator=(const PluginBranchPredictor &);
+
+  public:
+    PluginBranchPredictor(const bp_plugin *plugin, bp_predictor *predictor)
+        : plugin(plugin), predictor(predictor) {}
+
+    virtual ~PluginBranchPredictor() { plugin->destroy(predictor); }
+
+    virtual bool getPrediction(ADDRINT branchPC) {
+        return plugin->predict(predictor, branchPC) != 0;
+    }
+
+    virtual void train(ADDRINT branchPC, bool branchWasTaken) {
+        plugin->update(predictor, branchPC, branchWasTaken);
+    }
+
+    virtual UINT64 getStorageBits() { return plugin->storage_bits(predictor); }
+
+    virtual void trainBatch(const UINT64 *records, size_t count, UINT8 *predictions) {
+        if (plugin->update_batch == NULL)
+            BranchPredictorInterface::trainBatch(records, count, predictions);
+        else
+            plugin->update_batch(predictor, records, count, predictions);
+    }
+
+    // Copy out the predictor state, false if the plugin cannot
+    bool serialize(std::vector<UINT8> &state) {
+        if (plugin->serialize == NULL)
+            return false;
+        state.resize(plugin->serialize(predictor, NULL, 0));
+        return state.empty() ||
+               plugin->serialize(predictor, &state[0], state.size()) == state.size();
+    }
+
+    // Restore a state copied out by serialize(), false if the plugin cannot
+    bool deserialize(const std::vector<UINT8> &state) {
+        if (plugin->deserialize == NULL)
+            return false;
+        return plugin->deserialize(predictor, state.empty() ? NULL : &state[0],
+                                   state.size()) != 0;
+    }
+};
+
+// The plugins loaded so far. They stay loaded until the process exits.
+//
+inline std::vector<const bp_plugin *> &BranchPredictorPlugins() {
+    static std::vector<const bp_plugin *> plugins;
+    return plugins;
+}
+
+// Return the loaded plugin of the given predictor type, or NULL if there is
+// none
+//
+inline const bp_plugin *FindBranchPredictorPlugin(const std::string &type) {
+    std::vector<const bp_plugin *> &plugins = BranchPredictorPlugins();
+    for (size_t i = 0; i < plugins.size(); i++) {
+        if (type == plugins[i]->name)
+            return plugins[i];
+    }
+    return NULL;
+}
+
+// Load the plugin of the shared object at path and make its predictor type
+// available by name. Returns false and sets error if it cannot be loaded,
+// was built for another ABI version, or its name is already taken.
+//
+inline bool LoadBranchPredictorPlugin(const std::string &path, std::string &error) {
+    void *library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (library == NULL) {
+        const char *message = dlerror();
+        error = message ? message : "cannot load " + path;
+        return false;
+    }
+    bp_plugin_get_fn get = (bp_plugin_get_fn)dlsym(library, BP_PLUGIN_ENTRY_POINT);
+    const bp_plugin *plugin = get ? get() : NULL;
+    if (plugin == NULL) {
+        error = path + " does not export " BP_PLUGIN_ENTRY_POINT;
+    } else if (plugin->abi_version != BP_PLUGIN_ABI_VERSION) {
+        error = path + " was built for another plugin ABI version";
+    } else if (plugin->name == NULL || plugin->create == NULL ||
+               plugin->destroy == NULL || plugin->predict == NULL ||
+               plugin->update == NULL || plugin->storage_bits == NULL) {
+        error = path + " lacks a name or a required function";
+    } else if (FindBranchPredictorType(plugin->name) != NULL ||
+               FindBranchPredictorPlugin(plugin->name) != NULL ||
+               strncmp(plugin->name, "hybrid", 6) == 0) {
+        error = std::string("predictor type ") + plugin->name + " already exists";
+    } else {
+        BranchPredictorPlugins().push_back(plugin);
+        return true;
+    }
+    dlclose(library);
+    return false;
+}
+
+// Create a predictor of a plugin in memory, or on the heap if memory is NULL,
+// params being its comma separated name=value list
+//
+inline BranchPredictorInterface *CreatePluginPredictor(const bp_plugin *plugin,
+                                                       UINT64 numberOfEntries,
+                                                       const std::string &params,
+                                                       void *memory = NULL) {
+    bp_predictor *predictor = plugin->create(numberOfEntries, params.c_str());
+    if (predictor == NULL)
+        return NULL;
+    if (memory == NULL)
+        return new PluginBranchPredictor(plugin, predictor);
+    return new (memory) PluginBranchPredictor(plugin, predictor);
+}
+
+// Split a spec of a plugin's predictor type into the plugin, its number of
+// entries and its parameters as they are, false if the type is no plugin's
+// or the number of entries is malformed
+//
+inline bool ParsePluginSpec(const std::string &spec, const bp_plugin *&plugin,
+                            UINT64 &numberOfEntries, std::string &params) {
+    size_t colon = spec.find(':');
+    plugin = colon == std::string::npos ? NULL : FindBranchPredictorPlugin(spec.substr(0, colon));
+    if (plugin == NULL)
+        return false;
+    char *end;
+    numberOfEntries = strtoull(spec.c_str() + colon + 1, &end, 0);
+    if (numberOfEntries == 0 || (*end != '\0' && *end != ','))
+        return false;
+    params = *end ? end + 1 : "";
+    return true;
+}
+
+// Most components of a hybrid predictor
+//
+#define HYBRID_MAX_COMPONENTS 8
+
+// Hybrid of 2 to HYBRID_MAX_COMPONENTS predictors of any type, described by a
+// spec like "hybrid(local:1024,hist=10,gshare:4096,chooser=ghist:4096)": the
+// component specs, each followed by its parameters, and an optional chooser
+// indexed by the PC ("pc"), the global history ("ghist", as in the Alpha
+// 21264) or both xored ("pc_ghist"), by default "pc" with as many entries as
+// the first component. The components are built one after the other in one
+// block of memory owned by the hybrid.
+//
+// Every chooser entry has one 2-bit confidence counter per component (the
+// multi-hybrid of Evers et al.): the first component whose counter is
+// highest predicts. When a correct component is fully confident the
+// counters of the wrong ones are decremented, otherwise those of the
+// correct ones are incremented.
+//
+class HybridBranchPredictor : public BranchPredictorInterface {
+  private:
+    enum ChooserIndex { CHOOSER_PC, CHOOSER_GHIST, CHOOSER_PC_GHIST };
+
+    std::vector<UINT64> componentMemory;
+    BranchPredictorInterface *components[HYBRID_MAX_COMPONENTS];
+    UINT32 componentCount;
+    std::vector<UINT8> chooser;  // componentCount counters per entry
+    ChooserIndex chooserIndex;
+    ADDRINT chooserMask;
+    ADDRINT GHR;
+
+    HybridBranchPredictor() : componentCount(0), chooserIndex(CHOOSER_PC),
+                              chooserMask(0), GHR(0) {}
+    HybridBranchPredictor(const HybridBranchPredictor &);
+    HybridBranchPredictor &operator=(const HybridBranchPredictor &);
+
+    const UINT8 *GetChooserEntry(ADDRINT branchPC) const {
+        ADDRINT index = chooserIndex == CHOOSER_PC      ? branchPC
+                        : chooserIndex == CHOOSER_GHIST ? GHR
+                                                        : branchPC ^ GHR;
+        return &chooser[(index & chooserMask) * componentCount];
+    }
+
+    UINT32 GetChosenComponent(const UINT8 *entry) const {
+        UINT32 chosen = 0;
+        for (UINT32 i = 1; i < componentCount; i++) {
+            if (entry[i] > entry[chosen])
+                chosen = i;
+        }
+        return chosen;
+    }
+
+    bool ParseChooser(const std::string &chooserSpec, UINT64 &chooserEntries) {
+        size_t colon = chooserSpec.find(':');
+        if (colon == std::string::npos)
+            return false;
+        std::string index = chooserSpec.substr(0, colon);
+        if (index == "pc")
+            chooserIndex = CHOOSER_PC;
+        else if (index == "ghist")
+            chooserIndex = CHOOSER_GHIST;
+        else if (index == "pc_ghist")
+            chooserIndex = CHOOSER_PC_GHIST;
+        else
+            return false;
+        char *end;
+        chooserEntries = strtoull(chooserSpec.c_str() + colon + 1, &end, 0);
+        return chooserEntries != 0 && *end == '\0';
+    }
+
+    // Build the components of the specs in componentMemory. A plugin
+    // component is the PluginBranchPredictor holding the plugin's predictor.
+    bool BuildComponents(const std::vector<std::string> &specs) {
+        const BranchPredictorType *types[HYBRID_MAX_COMPONENTS];
+        const bp_plugin *plugins[HYBRID_MAX_COMPONENTS];
+        UINT64 entries[HYBRID_MAX_COMPONENTS];
+        BranchPredictorParams params[HYBRID_MAX_COMPONENTS];
+        std::string pluginParams[HYBRID_MAX_COMPONENTS];
+        size_t offsets[HYBRID_MAX_COMPONENTS];
+        size_t size = 0;
+        for (size_t i = 0; i < specs.size(); i++) {
+            std::string type;
+            types[i] = NULL;
+            size_t componentSize = sizeof(PluginBranchPredictor);
+            if (!ParsePluginSpec(specs[i], plugins[i], entries[i], pluginParams[i])) {
+                if (plugins[i] != NULL || !ParsePredictorSpec(specs[i], type, entries[i], params[i]))
+                    return false;
+                types[i] = FindBranchPredictorType(type);
+                if (types[i] == NULL || types[i]->alignment > sizeof(UINT64) ||
+                    (PredictorParamsSet(params[i]) & ~types[i]->params) != 0)
+                    return false;
+                componentSize = types[i]->size;
+            }
+            offsets[i] = size;
+            size += (componentSize + sizeof(UINT64) - 1) / sizeof(UINT64) * sizeof(UINT64);
+        }
+
+        componentMemory.resize(size / sizeof(UINT64));
+        char *memory = (char *)&componentMemory[0];
+        for (size_t i = 0; i < specs.size(); i++) {
+            if (types[i] != NULL)
+                components[i] = types[i]->construct(memory + offsets[i], entries[i], params[i]);
+            else
+                components[i] = CreatePluginPredictor(plugins[i], entries[i], pluginParams[i],
+                                                      memory + offsets[i]);
+            if (components[i] == NULL)
+                return false;
+            componentCount++;
+        }
+        return true;
+    }
+
+  public:
+    virtual ~HybridBranchPredictor() {
+        for (UINT32 i = 0; i < componentCount; i++)
+            components[i]->~BranchPredictorInterface();
+    }
+
+    // Return the hybrid of the spec, or NULL if it is malformed
+    static HybridBranchPredictor *Create(const std::string &spec) {
+        const std::string prefix = "hybrid(";
+        if (spec.compare(0, prefix.size(), prefix) != 0 || spec.size() <= prefix.size() ||
+            spec[spec.size() - 1] != ')')
+            return NULL;
+        std::string list = spec.substr(prefix.size(), spec.size() - prefix.size() - 1);
+
+        // a token with a colon starts a component, a param=value token belongs
+        // to the component before it
+        std::vector<std::string> specs;
+        std::string chooserSpec;
+        size_t start = 0;
+        while (start <= list.size()) {
+            size_t comma = list.find(',', start);
+            if (comma == std::string::npos)
+                comma = list.size();
+            std::string token = list.substr(start, comma - start);
+            start = comma + 1;
+            if (token.compare(0, 8, "chooser=") == 0 && token.find(':') != std::string::npos)
+                chooserSpec = token.substr(8);
+            else if (token.find(':') != std::string::npos)
+                specs.push_back(token);
+            else if (!specs.empty() && token.find('=') != std::string::npos)
+                specs.back() += "," + token;
+            else
+                return NULL;
+        }
+        if (specs.size() < 2 || specs.size() > HYBRID_MAX_COMPONENTS)
+            return NULL;
+
+        HybridBranchPredictor *hybrid = new HybridBranchPredictor();
+        UINT64 chooserEntries = 0;
+        if (!hybrid->BuildComponents(specs) ||
+            (!chooserSpec.empty() && !hybrid->ParseChooser(chooserSpec, chooserEntries))) {
+            delete hybrid;
+            return NULL;
+        }
+        if (chooserEntries == 0) {
+            std::string type, pluginParams;
+            BranchPredictorParams params;
+            const bp_plugin *plugin;
+            if (!ParsePluginSpec(specs[0], plugin, chooserEntries, pluginParams))
+                ParsePredictorSpec(specs[0], type, chooserEntries, params);
+        }
+        hybrid->chooserMask = LsbMask(IndexBits(chooserEntries));
+        hybrid->chooser = std::vector<UINT8>((hybrid->chooserMask + 1) * specs.size(), 0b11);
+        return hybrid;
+    }
+
+    virtual bool getPrediction(ADDRINT branchPC) {
+        return components[GetChosenComponent(GetChooserEntry(branchPC))]->getPrediction(branchPC);
+    }
+
+    virtual void train(ADDRINT branchPC, bool branchWasTaken) {
+        UINT8 *entry = (UINT8 *)GetChooserEntry(branchPC);
+        bool correct[HYBRID_MAX_COMPONENTS];
+        bool confidentCorrect = false;
+        for (UINT32 i = 0; i < componentCount; i++) {
+            correct[i] = components[i]->getPrediction(branchPC) == branchWasTaken;
+            confidentCorrect |= correct[i] && entry[i] == 0b11;
+        }
+        for (UINT32 i = 0; i < componentCount; i++) {
+            if (confidentCorrect && !correct[i])
+                entry[i] = saturatorWeaken(entry[i]);
+            else if (!confidentCorrect && correct[i])
+                entry[i] = saturatorStrengthen(entry[i]);
+            components[i]->train(branchPC, branchWasTaken);
+        }
+
+        GHR = GHR << 1;
+        GHR += branchWasTaken;
+    }
+
+    virtual UINT64 getStorageBits() {
+        UINT64 bits = chooser.size() * 2;
+        if (chooserIndex != CHOOSER_PC)
+            bits += IndexBits(chooserMask + 1);
+        for (UINT32 i = 0; i < componentCount; i++)
+            bits += components[i]->getStorageBits();
+        return bits;
+    }
+};
+
+
+// Return the bits of the parameters set in params that a predictor type does
+// not take. A hybrid spec as type takes none, its components have their own.
+//
+inline UINT32 UnsupportedPredictorParams(const std::string &type,
+                                         const BranchPredictorParams &params) {
+    const BranchPredictorType *predictorType = FindBranchPredictorType(type);
+    if (predictorType != NULL)
+        return PredictorParamsSet(params) & ~predictorType->params;
+    if (type.compare(0, 7, "hybrid(") == 0)
+        return PredictorParamsSet(params);
+    return 0;
+}
+
+// Create a branch predictor of the given type, or return NULL if there is no
+// such type or it does not take one of the parameters set. A hybrid spec as
+// type makes the hybrid, whose components have their own sizes and
+// parameters. A plugin gets the parameters set as hist=, ctr=, lhr= and
+// chooser=.
+//
+inline BranchPredictorInterface *
+CreateBranchPredictor(const std::string &type, UINT64 numberOfEntries,
+                      const BranchPredictorParams &params = BranchPredictorParams()) {
+    if (UnsupportedPredictorParams(type, params) != 0)
+        return NULL;
+    if (type.compare(0, 7, "hybrid(") == 0)
+        return HybridBranchPredictor::Create(type);
+    const bp_plugin *plugin = FindBranchPredictorPlugin(type);
+    if (plugin != NULL) {
+        const char *names[] = {"hist", "ctr", "lhr", "chooser"};
+        UINT64 values[] = {params.historyLength, params.counterBits,
+                           params.localHistoryEntries, params.chooserEntries};
+        std::string pluginParams;
+        for (int i = 0; i < 4; i++) {
+            if (values[i] == 0)
+                continue;
+            char param[48];
+            snprintf(param, sizeof(param), "%s%s=%llu", pluginParams.empty() ? "" : ",",
+                     names[i], (unsigned long long)values[i]);
+            pluginParams += param;
+        }
+        return CreatePluginPredictor(plugin, numberOfEntries, pluginParams);
+    }
+    const BranchPredictorType *predictorType = FindBranchPredictorType(type);
+    if (predictorType == NULL)
+        return NULL;
+    return predictorType->construct(NULL, numberOfEntries, params);
+}
+
+// Create the predictor described by a spec or a hybrid spec, or return NULL if
+// the spec is malformed or names no predictor. A plugin gets the parameters
+// after its table size as they are.
+//
+inline BranchPredictorInterface *CreatePredictorFromSpec(const std::string &spec) {
+    if (spec.compare(0, 7, "hybrid(") == 0)
+        return HybridBranchPredictor::Create(spec);
+    const bp_plugin *plugin;
+    std::string type, pluginParams;
+    UINT64 numberOfEntries;
+    if (ParsePluginSpec(spec, plugin, numberOfEntries, pluginParams))
+        return CreatePluginPredictor(plugin, numberOfEntries, pluginParams);
+    if (plugin != NULL)
+        return NULL;
+    BranchPredictorParams params;
+    if (!ParsePredictorSpec(spec, type, numberOfEntries, params))
+        return NULL;
+    return CreateBranchPredictor(type, numberOfEntries, params);
+}
+
+#endif // BRANCH_PREDICTORS_H
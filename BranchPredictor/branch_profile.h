@@ -0,0 +1,133 @@
+#ifndef BRANCH_PROFILE_H
+#define BRANCH_PROFILE_H
+
+// Branch profile written by the profiling pass of the pintool and read by its
+// simulation passes: the execution and taken counts of every static
+// conditional branch, and the number of conditional branches executed in
+// every interval of the run. It is a text file:
+//
+//   bp_profile 1
+//   instructions <count>
+//   static_branches <static conditional branches instrumented>
+//   interval_length <instructions>
+//   interval <conditional branches>         one line per interval
+//   branch <pc in hex> <executions> <taken> one line per static branch
+//
+#include "branch_stats.h"
+#include <fstream>
+#include <map>
+#include <string>
+
+#define BRANCH_PROFILE_VERSION 1
+
+// Branches executed fewer times than this are never considered biased, their
+// re-instrumentation would cost more than it saves
+//
+#define BRANCH_PROFILE_MIN_BIASED_EXECUTIONS 1000
+
+class BranchProfile {
+  public:
+    UINT64 instructions;
+    UINT64 staticBranches;
+    UINT64 intervalLength;
+    std::vector<UINT64> intervalBranches;
+    std::map<ADDRINT, BranchStats> branches;
+
+    BranchProfile() : instructions(0), staticBranches(0), intervalLength(0) {}
+
+    bool Save(const std::string &path) const {
+        std::ofstream file(path.c_str());
+        file << "bp_profile " << BRANCH_PROFILE_VERSION << std::endl
+             << "instructions " << instructions << std::endl
+             << "static_branches " << staticBranches << std::endl
+             << "interval_length " << intervalLength << std::endl;
+        for (size_t i = 0; i < intervalBranches.size(); i++)
+            file << "interval " << intervalBranches[i] << std::endl;
+        std::map<ADDRINT, BranchStats>::const_iterator it;
+        for (it = branches.begin(); it != branches.end(); ++it)
+            file << "branch " << std::hex << it->second.pc << std::dec << " "
+                 << it->second.executions << " " << it->second.takenCount
+                 << std::endl;
+        return file.good();
+    }
+
+    bool Load(const std::string &path) {
+        std::ifstream file(path.c_str());
+        std::string word;
+        UINT32 version = 0;
+        if (!(file >> word >> version) || word != "bp_profile" ||
+            version != BRANCH_PROFILE_VERSION)
+            return false;
+
+        while (file >> word) {
+            if (word == "instructions") {
+                file >> instructions;
+            } else if (word == "static_branches") {
+                file >> staticBranches;
+            } else if (word == "interval_length") {
+                file >> intervalLength;
+            } else if (word == "interval") {
+                UINT64 count = 0;
+                file >> count;
+                intervalBranches.push_back(count);
+            } else if (word == "branch") {
+                BranchStats branch = {0, 0, 0, 0};
+                file >> std::hex >> branch.pc >> std::dec >> branch.executions >>
+                    branch.takenCount;
+                branches[branch.pc] = branch;
+            } else {
+                return false;
+            }
+            if (file.fail())
+                return false;
+        }
+        return file.eof();
+    }
+
+    // True when the branch was executed often and always resolved the same way
+    bool IsFullyBiased(ADDRINT branchPC) const {
+        std::map<ADDRINT, BranchStats>::const_iterator it = branches.find(branchPC);
+        if (it == branches.end() ||
+            it->second.executions < BRANCH_PROFILE_MIN_BIASED_EXECUTIONS)
+            return false;
+        return it->second.takenCount == 0 ||
+               it->second.takenCount == it->second.executions;
+    }
+
+    // Return the first instruction of the window of windowLength instructions,
+    // starting at an interval, whose conditional branch density is closest to
+    // that of the whole run. 0 when the run is not longer than the window.
+    UINT64 SelectWindow(UINT64 windowLength) const {
+        size_t fullIntervals = intervalLength ? instructions / intervalLength : 0;
+        size_t windowIntervals =
+            intervalLength ? (windowLength + intervalLength - 1) / intervalLength : 0;
+        if (windowIntervals == 0 || windowIntervals >= fullIntervals ||
+            fullIntervals > intervalBranches.size())
+            return 0;
+
+        UINT64 totalBranches = 0;
+        for (size_t i = 0; i < intervalBranches.size(); i++)
+            totalBranches += intervalBranches[i];
+        double density = (double)totalBranches / instructions;
+
+        UINT64 windowBranches = 0;
+        for (size_t i = 0; i < windowIntervals; i++)
+            windowBranches += intervalBranches[i];
+        size_t bestStart = 0;
+        double bestDistance = fabs(
+            (double)windowBranches / (windowIntervals * intervalLength) - density);
+        for (size_t start = 1; start + windowIntervals <= fullIntervals; start++) {
+            windowBranches += intervalBranches[start + windowIntervals - 1];
+            windowBranches -= intervalBranches[start - 1];
+            double distance = fabs(
+                (double)windowBranches / (windowIntervals * intervalLength) - density);
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                bestStart = start;
+            }
+        }
+        return bestStart * intervalLength;
+    }
+};
+
+#endif // BRANCH_PROFILE_H
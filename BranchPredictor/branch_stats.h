@@ -0,0 +1,93 @@
+#ifndef BRANCH_STATS_H
+#define BRANCH_STATS_H
+
+// Per static branch counters, kept in an array indexed by the dense static
+// branch ID the pintool assigns at instrumentation time, so the analysis
+// routine does not hash the PC. The array is preallocated for the expected
+// number of static branches and only grows when a branch is instrumented.
+//
+#include "branch_predictors.h"
+#include <algorithm>
+
+struct BranchStats {
+    ADDRINT pc;
+    UINT64 executions;
+    UINT64 takenCount;
+    UINT64 mispredictions;
+};
+
+class BranchStatsTable {
+  private:
+    std::vector<BranchStats> branches;
+    bool enabled;
+
+  public:
+    BranchStatsTable() : enabled(false) {}
+
+    // Preallocate the table for expectedBranches static branches
+    void Init(UINT64 expectedBranches) {
+        branches.reserve(expectedBranches);
+        enabled = true;
+    }
+
+    bool IsEnabled() const { return enabled; }
+
+    // Add the static branch with the given ID, called at instrumentation time
+    void AddBranch(UINT32 branchId, ADDRINT branchPC) {
+        if (branchId >= branches.size()) {
+            BranchStats empty = {0, 0, 0, 0};
+            branches.resize(branchId + 1, empty);
+        }
+        branches[branchId].pc = branchPC;
+    }
+
+    void Record(UINT32 branchId, bool branchWasTaken, bool mispredicted) {
+        BranchStats &branch = branches[branchId];
+        branch.executions++;
+        branch.takenCount += branchWasTaken;
+        branch.mispredictions += mispredicted;
+    }
+
+    // Record count executions with the same outcome and prediction at once
+    void RecordBulk(UINT32 branchId, bool branchWasTaken, bool mispredicted,
+                    UINT64 count) {
+        BranchStats &branch = branches[branchId];
+        branch.executions += count;
+        branch.takenCount += branchWasTaken ? count : 0;
+        branch.mispredictions += mispredicted ? count : 0;
+    }
+
+    // Number of static branches executed
+    size_t Size() const {
+        size_t count = 0;
+        for (size_t i = 0; i < branches.size(); i++)
+            count += branches[i].executions != 0;
+        return count;
+    }
+
+    // Copy out the counters of every executed static branch
+    void Collect(std::vector<BranchStats> &executed) const {
+        executed.clear();
+        for (size_t i = 0; i < branches.size(); i++) {
+            if (branches[i].executions != 0)
+                executed.push_back(branches[i]);
+        }
+    }
+};
+
+inline bool MoreMispredictions(const BranchStats &a, const BranchStats &b) {
+    if (a.mispredictions != b.mispredictions)
+        return a.mispredictions > b.mispredictions;
+    return a.pc < b.pc;
+}
+
+// Compares misprediction rates without dividing
+inline bool HigherMispredictionRate(const BranchStats &a, const BranchStats &b) {
+    double left = (double)a.mispredictions * b.executions;
+    double right = (double)b.mispredictions * a.executions;
+    if (left != right)
+        return left > right;
+    return MoreMispredictions(a, b);
+}
+
+#endif // BRANCH_STATS_H
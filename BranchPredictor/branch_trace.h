@@ -0,0 +1,472 @@
+#ifndef BRANCH_TRACE_H
+#define BRANCH_TRACE_H
+
+// Captured conditional branch traces, in one of two formats.
+//
+// A raw trace is a BranchTraceHeader followed by one 64-bit record per
+// executed conditional branch, holding the branch PC shifted left by one and
+// the branch outcome in the lowest bit.
+//
+// A compressed trace splits the branches into three streams: a dictionary of
+// the unique static branch PCs, the dictionary IDs of the executed branches
+// as varints, and their outcomes packed one bit per branch. The ID and outcome
+// streams are cut into blocks of COMPRESSED_TRACE_BLOCK_BRANCHES branches and
+// each stream of a block is compressed on its own with the trace codec, so
+// that any block can be decoded given only the dictionary. The file is a
+// CompressedTraceHeader, the blocks, the dictionary and the file offset of
+// every block.
+//
+#include "branch_predictors.h"
+#include "trace_codec.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+#define BRANCH_TRACE_MAGIC "BPTRACE1"
+#define COMPRESSED_TRACE_MAGIC "BPTRACEZ"
+
+// Records are buffered and written out in blocks of this many branches
+//
+#define BRANCH_TRACE_BUFFER_RECORDS 65536
+
+// Number of branches in every block of a compressed trace but the last one
+//
+#define COMPRESSED_TRACE_BLOCK_BRANCHES 65536
+
+struct BranchTraceHeader {
+    char magic[8];
+    UINT64 branchCount;
+    UINT64 instructionCount;
+};
+
+struct CompressedTraceHeader {
+    BranchTraceHeader trace;
+    UINT64 blockBranches;
+    UINT64 blockCount;
+    UINT64 dictionarySize;
+    UINT64 dictionaryOffset;
+    UINT64 blockIndexOffset;
+};
+
+// Sizes of the streams of one block. A stream whose compressed size equals
+// its decoded size is stored as is.
+//
+struct CompressedTraceBlockHeader {
+    UINT32 branchCount;
+    UINT32 idStreamSize;
+    UINT32 idCompressedSize;
+    UINT32 takenCompressedSize;
+};
+
+inline UINT64 EncodeBranchRecord(ADDRINT branchPC, bool branchWasTaken) {
+    return ((UINT64)branchPC << 1) | branchWasTaken;
+}
+
+inline ADDRINT BranchRecordPC(UINT64 record) { return record >> 1; }
+
+inline bool BranchRecordTaken(UINT64 record) { return record & 1; }
+
+// Appends branches to a trace file. The header is rewritten on Close(), once
+// the number of branches and instructions is known. A failed write, e.g. on a
+// full disk, is remembered and reported by Close().
+//
+class BranchTraceWriter {
+  private:
+    FILE *file;
+    bool compressed;
+    bool failed;
+    UINT64 branchCount;
+    UINT64 fileOffset;
+
+    // raw traces
+    std::vector<UINT64> buffer;
+
+    // compressed traces: the dictionary, the PC to ID hash table with PC + 1
+    // as key and zero for empty slots, and the streams of the current block
+    std::vector<UINT64> dictionary;
+    std::vector<UINT64> idTableKeys;
+    std::vector<UINT32> idTableValues;
+    std::vector<UINT8> idStream;
+    std::vector<UINT8> takenStream;
+    std::vector<UINT8> compressedStream;
+    std::vector<UINT64> blockOffsets;
+    UINT32 blockBranchCount;
+
+    void Write(const void *data, size_t size) {
+        if (fwrite(data, 1, size, file) != size)
+            failed = true;
+        fileOffset += size;
+    }
+
+    void WriteAt(UINT64 offset, const void *data, size_t size) {
+        if (fseek(file, offset, SEEK_SET) != 0 || fwrite(data, 1, size, file) != size)
+            failed = true;
+    }
+
+    void Flush() {
+        if (!buffer.empty())
+            Write(&buffer[0], buffer.size() * sizeof(UINT64));
+        buffer.clear();
+    }
+
+    void WriteHeader(UINT64 instructionCount) {
+        CompressedTraceHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.trace.magic,
+               compressed ? COMPRESSED_TRACE_MAGIC : BRANCH_TRACE_MAGIC,
+               sizeof(header.trace.magic));
+        header.trace.branchCount = branchCount;
+        header.trace.instructionCount = instructionCount;
+        header.blockBranches = COMPRESSED_TRACE_BLOCK_BRANCHES;
+        header.blockCount = blockOffsets.size();
+        header.dictionarySize = dictionary.size();
+        if (compressed) {
+            header.dictionaryOffset = fileOffset;
+            header.blockIndexOffset =
+                fileOffset + dictionary.size() * sizeof(UINT64);
+            WriteAt(0, &header, sizeof(header));
+        } else {
+            WriteAt(0, &header.trace, sizeof(header.trace));
+        }
+    }
+
+    UINT32 GetBranchId(ADDRINT branchPC) {
+        size_t mask = idTableKeys.size() - 1;
+        size_t slot = (branchPC * 0x9E3779B97F4A7C15ULL) >> 32 & mask;
+        while (idTableKeys[slot] != 0) {
+            if (idTableKeys[slot] == (UINT64)branchPC + 1)
+                return idTableValues[slot];
+            slot = (slot + 1) & mask;
+        }
+
+        UINT32 branchId = dictionary.size();
+        dictionary.push_back(branchPC);
+        idTableKeys[slot] = (UINT64)branchPC + 1;
+        idTableValues[slot] = branchId;
+        if (dictionary.size() * 2 > idTableKeys.size())
+            GrowIdTable();
+        return branchId;
+    }
+
+    void GrowIdTable() {
+        idTableKeys.assign(idTableKeys.size() * 2, 0);
+        idTableValues.resize(idTableKeys.size());
+        size_t mask = idTableKeys.size() - 1;
+        for (UINT32 branchId = 0; branchId < dictionary.size(); branchId++) {
+            size_t slot = (dictionary[branchId] * 0x9E3779B97F4A7C15ULL) >> 32 & mask;
+            while (idTableKeys[slot] != 0)
+                slot = (slot + 1) & mask;
+            idTableKeys[slot] = dictionary[branchId] + 1;
+            idTableValues[slot] = branchId;
+        }
+    }
+
+    void WriteStream(const std::vector<UINT8> &stream, UINT32 &compressedSize) {
+        TraceCodecCompress(&stream[0], stream.size(), compressedStream);
+        if (compressedStream.size() < stream.size()) {
+            compressedSize = compressedStream.size();
+            Write(&compressedStream[0], compressedStream.size());
+        } else {
+            compressedSize = stream.size();
+            Write(&stream[0], stream.size());
+        }
+    }
+
+    void FlushBlock() {
+        if (blockBranchCount == 0)
+            return;
+
+        CompressedTraceBlockHeader blockHeader;
+        blockHeader.branchCount = blockBranchCount;
+        blockHeader.idStreamSize = idStream.size();
+        takenStream.resize((blockBranchCount + 7) / 8);
+
+        // the sizes are only known once the streams are written
+        UINT64 headerOffset = fileOffset;
+        blockOffsets.push_back(headerOffset);
+        Write(&blockHeader, sizeof(blockHeader));
+        WriteStream(idStream, blockHeader.idCompressedSize);
+        WriteStream(takenStream, blockHeader.takenCompressedSize);
+        WriteAt(headerOffset, &blockHeader, sizeof(blockHeader));
+        if (fseek(file, fileOffset, SEEK_SET) != 0)
+            failed = true;
+
+        idStream.clear();
+        takenStream.assign(COMPRESSED_TRACE_BLOCK_BRANCHES / 8, 0);
+        blockBranchCount = 0;
+    }
+
+  public:
+    BranchTraceWriter()
+        : file(NULL), compressed(false), failed(false), branchCount(0),
+          fileOffset(0), blockBranchCount(0) {}
+
+    bool Open(const std::string &path, bool compressedFormat) {
+        file = fopen(path.c_str(), "wb");
+        if (file == NULL)
+            return false;
+        compressed = compressedFormat;
+        failed = false;
+        if (compressed) {
+            idTableKeys.assign(1024, 0);
+            idTableValues.resize(idTableKeys.size());
+            idStream.reserve(COMPRESSED_TRACE_BLOCK_BRANCHES * 2);
+            takenStream.assign(COMPRESSED_TRACE_BLOCK_BRANCHES / 8, 0);
+        } else {
+            buffer.reserve(BRANCH_TRACE_BUFFER_RECORDS);
+        }
+        WriteHeader(0);
+        fileOffset = compressed ? sizeof(CompressedTraceHeader)
+                                : sizeof(BranchTraceHeader);
+        return true;
+    }
+
+    bool IsOpen() { return file != NULL; }
+
+    void Append(ADDRINT branchPC, bool branchWasTaken) {
+        AppendWithId(compressed ? GetBranchId(branchPC) : 0, branchPC,
+                     branchWasTaken);
+    }
+
+    // Append a branch whose dense static ID the caller assigned itself, which
+    // saves the PC lookup of Append(). A writer takes either IDs from its
+    // caller or from Append(), not both.
+    void AppendWithId(UINT32 branchId, ADDRINT branchPC, bool branchWasTaken) {
+        branchCount++;
+        if (!compressed) {
+            buffer.push_back(EncodeBranchRecord(branchPC, branchWasTaken));
+            if (buffer.size() == BRANCH_TRACE_BUFFER_RECORDS)
+                Flush();
+            return;
+        }
+
+        if (branchId >= dictionary.size())
+            dictionary.resize(branchId + 1, 0);
+        dictionary[branchId] = branchPC;
+        for (; branchId >= 0x80; branchId >>= 7)
+            idStream.push_back((branchId & 0x7f) | 0x80);
+        idStream.push_back(branchId);
+        takenStream[blockBranchCount / 8] |= branchWasTaken << (blockBranchCount % 8);
+        if (++blockBranchCount == COMPRESSED_TRACE_BLOCK_BRANCHES)
+            FlushBlock();
+    }
+
+    // Write out the rest of the trace and its header, false if any write
+    // failed
+    bool Close(UINT64 instructionCount) {
+        if (file == NULL)
+            return !failed;
+        if (compressed) {
+            FlushBlock();
+            UINT64 dictionaryOffset = fileOffset;
+            if (!dictionary.empty())
+                Write(&dictionary[0], dictionary.size() * sizeof(UINT64));
+            if (!blockOffsets.empty())
+                Write(&blockOffsets[0], blockOffsets.size() * sizeof(UINT64));
+            fileOffset = dictionaryOffset;
+        } else {
+            Flush();
+        }
+        WriteHeader(instructionCount);
+        if (fclose(file) != 0)
+            failed = true;
+        file = NULL;
+        return !failed;
+    }
+};
+
+// Reads a trace file of either format through a read-only shared mapping.
+// Raw records are handed out in place, without copying, and concurrent
+// readers of the same trace share its page cache pages. Compressed traces are
+// decoded one block at a time into a buffer supplied by the caller.
+//
+class BranchTraceReader {
+  private:
+    int fd;
+    void *mapping;
+    size_t mappingSize;
+    const BranchTraceHeader *header;
+    const UINT64 *records;
+    UINT64 nextRecord;
+    bool failed;
+
+    // compressed traces
+    const CompressedTraceHeader *compressedHeader;
+    std::vector<UINT64> dictionaryRecords;
+    const char *blockOffsets;  // not aligned, read with memcpy
+    UINT64 nextBlock;
+    UINT64 skipRecords;
+    std::vector<UINT8> idStream;
+    std::vector<UINT8> takenStream;
+
+    bool InMapping(UINT64 offset, UINT64 size) {
+        return offset <= mappingSize && size <= mappingSize - offset;
+    }
+
+    bool OpenCompressed() {
+        compressedHeader = (const CompressedTraceHeader *)mapping;
+        if (mappingSize < sizeof(CompressedTraceHeader) ||
+            compressedHeader->blockBranches == 0 ||
+            !InMapping(compressedHeader->dictionaryOffset,
+                       compressedHeader->dictionarySize * sizeof(UINT64)) ||
+            !InMapping(compressedHeader->blockIndexOffset,
+                       compressedHeader->blockCount * sizeof(UINT64)))
+            return false;
+
+        // the dictionary is kept pre-shifted, ready to be or-ed with outcomes.
+        // It follows the byte-sized streams, so it is not aligned.
+        dictionaryRecords.resize(compressedHeader->dictionarySize);
+        if (!dictionaryRecords.empty())
+            memcpy(&dictionaryRecords[0],
+                   (const char *)mapping + compressedHeader->dictionaryOffset,
+                   dictionaryRecords.size() * sizeof(UINT64));
+        for (size_t i = 0; i < dictionaryRecords.size(); i++)
+            dictionaryRecords[i] = EncodeBranchRecord(dictionaryRecords[i], false);
+        blockOffsets = (const char *)mapping + compressedHeader->blockIndexOffset;
+        return true;
+    }
+
+    bool ReadStream(const UINT8 *&data, UINT32 compressedSize,
+                    std::vector<UINT8> &stream) {
+        if (stream.empty())
+            return compressedSize == 0;
+        if (compressedSize == stream.size())
+            memcpy(&stream[0], data, compressedSize);
+        else if (!TraceCodecDecompress(data, compressedSize, &stream[0], stream.size()))
+            return false;
+        data += compressedSize;
+        return true;
+    }
+
+    bool DecodeBlock(UINT64 block, std::vector<UINT64> &buffer, size_t &count) {
+        UINT64 offset;
+        memcpy(&offset, blockOffsets + block * sizeof(UINT64), sizeof(offset));
+        if (!InMapping(offset, sizeof(CompressedTraceBlockHeader)))
+            return false;
+        CompressedTraceBlockHeader blockHeader;
+        memcpy(&blockHeader, (const char *)mapping + offset, sizeof(blockHeader));
+        if (!InMapping(offset + sizeof(blockHeader),
+                       (UINT64)blockHeader.idCompressedSize +
+                           blockHeader.takenCompressedSize) ||
+            blockHeader.branchCount > compressedHeader->blockBranches)
+            return false;
+
+        const UINT8 *data = (const UINT8 *)mapping + offset + sizeof(blockHeader);
+        count = blockHeader.branchCount;
+        idStream.resize(blockHeader.idStreamSize);
+        takenStream.resize((count + 7) / 8);
+        if (!ReadStream(data, blockHeader.idCompressedSize, idStream) ||
+            !ReadStream(data, blockHeader.takenCompressedSize, takenStream))
+            return false;
+
+        buffer.resize(std::max<size_t>(buffer.size(), count));
+        const UINT8 *id = idStream.empty() ? NULL : &idStream[0];
+        const UINT8 *idEnd = id + idStream.size();
+        for (size_t i = 0; i < count; i++) {
+            UINT64 branchId = 0;
+            for (int shift = 0;; shift += 7) {
+                if (id == idEnd)
+                    return false;
+                UINT8 byte = *id++;
+                branchId |= (UINT64)(byte & 0x7f) << shift;
+                if (byte < 0x80)
+                    break;
+            }
+            if (branchId >= dictionaryRecords.size())
+                return false;
+            buffer[i] = dictionaryRecords[branchId] | ((takenStream[i / 8] >> (i % 8)) & 1);
+        }
+        return true;
+    }
+
+  public:
+    BranchTraceReader()
+        : fd(-1), mapping(MAP_FAILED), mappingSize(0), header(NULL),
+          records(NULL), nextRecord(0), failed(false),
+          compressedHeader(NULL), blockOffsets(NULL), nextBlock(0),
+          skipRecords(0) {}
+
+    ~BranchTraceReader() {
+        if (mapping != MAP_FAILED)
+            munmap(mapping, mappingSize);
+        if (fd != -1)
+            close(fd);
+    }
+
+    bool Open(const std::string &path) {
+        struct stat fileStat;
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1 || fstat(fd, &fileStat) != 0 ||
+            (size_t)fileStat.st_size < sizeof(BranchTraceHeader))
+            return false;
+
+        mappingSize = fileStat.st_size;
+        mapping = mmap(NULL, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED)
+            return false;
+        madvise(mapping, mappingSize, MADV_SEQUENTIAL);
+
+        header = (const BranchTraceHeader *)mapping;
+        if (memcmp(header->magic, COMPRESSED_TRACE_MAGIC, sizeof(header->magic)) == 0)
+            return OpenCompressed();
+        records = (const UINT64 *)(header + 1);
+        if (memcmp(header->magic, BRANCH_TRACE_MAGIC, sizeof(header->magic)) != 0)
+            return false;
+        // a truncated capture only holds the records that were flushed
+        return header->branchCount <=
+               (mappingSize - sizeof(BranchTraceHeader)) / sizeof(UINT64);
+    }
+
+    UINT64 BranchCount() { return header->branchCount; }
+
+    UINT64 InstructionCount() { return header->instructionCount; }
+
+    bool IsCompressed() { return compressedHeader != NULL; }
+
+    // True if a corrupt block was met, the trace then ends early
+    bool Failed() { return failed; }
+
+    // Continue reading at the given branch
+    void Seek(UINT64 branch) {
+        branch = std::min(branch, BranchCount());
+        if (compressedHeader == NULL) {
+            nextRecord = branch;
+        } else {
+            nextBlock = branch / compressedHeader->blockBranches;
+            skipRecords = branch % compressedHeader->blockBranches;
+        }
+    }
+
+    // Return the next count records, or fewer at the end of the trace, and
+    // update count. Raw records are returned in place and stay valid as long
+    // as the reader is open. Compressed traces return the rest of one block
+    // per call, whatever count asked for, decoded into buffer.
+    const UINT64 *Next(std::vector<UINT64> &buffer, size_t &count) {
+        if (compressedHeader == NULL) {
+            count = std::min<UINT64>(count, BranchCount() - nextRecord);
+            const UINT64 *next = records + nextRecord;
+            nextRecord += count;
+            return next;
+        }
+
+        count = 0;
+        if (nextBlock == compressedHeader->blockCount || failed)
+            return NULL;
+        if (!DecodeBlock(nextBlock++, buffer, count) || skipRecords > count) {
+            failed = true;
+            count = 0;
+            return NULL;
+        }
+        // the first block after a Seek() starts part way in
+        size_t skip = skipRecords;
+        skipRecords = 0;
+        count -= skip;
+        return &buffer[skip];
+    }
+};
+
+#endif // BRANCH_TRACE_H
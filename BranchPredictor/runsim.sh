@@ -1,30 +1,53 @@
 #!/bin/bash
+#
+# Usage: ./runsim.sh all [sweep.sh options]
+#        ./runsim.sh <BP_type> <num_BP_entries> <benchmark> [output file] [pintool knobs...]
+#
+# Set SKIP_BUILD=1 to reuse an already built pintool.
+#
+# "-profile_use auto" uses the branch profile of the benchmark kept in
+# $BP_PROFILE_CACHE (default ~/.cache/bp_profiles) under the hash of its binary
+# and input files, and records it with a profiling pass if there is none yet.
 
-mkdir obj-intel64/
-make obj-intel64/branch_predictor.so TARGET=intel64 PIN_ROOT=$PIN_ROOT;
+if [[ -z $SKIP_BUILD ]] ; then
+    mkdir obj-intel64/
+    make obj-intel64/branch_predictor.so TARGET=intel64 PIN_ROOT=$PIN_ROOT;
+fi
 
 if [[ $1 == 'all' ]] ; then 
-    for bench in sjeng gobmk gromacs ; do
-        for bp_type in 'local' 'gshare' 'tournament' ; do
-            for num_bp_entry in 128 1024 4096 ; do
-                printf '%-12.12s ' $bp_type $num_bp_entry $bench
-                ./runsim.sh $bp_type $num_bp_entry $bench 2>&1 1>/dev/null | grep "Prediction accuracy"
-                # printf "\n"
-            done
-        done
-    done
+    shift
+    SKIP_BUILD=1 exec ./sweep.sh "$@"
 else 
-    if [[ $3 == 'sjeng' ]] ; then 
-    	benchmark="$SJENG_PATH/sjeng_base.amd64-m64-gcc41-nn $SJENG_PATH/ref.txt"
-        pin -t $BP_EXAMPLE/obj-intel64/branch_predictor.so -BP_type $1 -o "$1.out" -num_BP_entries $2 -- $benchmark
-    elif [[ $3 == 'gobmk' ]] ; then 
-        pin -t $BP_EXAMPLE/obj-intel64/branch_predictor.so -BP_type $1 -o "$1.out" -num_BP_entries $2 -- $GOBMK_PATH/gobmk_base.amd64-m64-gcc41-nn --quiet --mode gtp < $GOBMK_PATH/13x13.tst 
-    elif [[ $3 == 'gromacs' ]] ; then
-    	benchmark="$GROMACS_PATH/gromacs_base.amd64-m64-gcc41-nn -silent -deffnm $GROMACS_DATA/gromacs"
-        pin -t $BP_EXAMPLE/obj-intel64/branch_predictor.so -BP_type $1 -o "$1.out" -num_BP_entries $2 -- $benchmark
-    elif [[ $3 == 'test' ]] ; then
-        pin -t $BP_EXAMPLE/obj-intel64/branch_predictor.so -BP_type $1 -o "$1.out" -num_BP_entries $2 -- ../tests/test.out
+    source ./benchmarks.sh
+    set_benchmark $3 || exit 1
+    outfile=${4:-"$1.out"}
+    knobs=(-BP_type "$1" -o "$outfile" -num_BP_entries $2 "${@:5}")
+    for ((i = 0; i < ${#knobs[@]} - 1; i++)) ; do
+        if [[ ${knobs[$i]} == '-profile_use' && ${knobs[$((i + 1))]} == 'auto' ]] ; then
+            profile_cache=${BP_PROFILE_CACHE:-"$HOME/.cache/bp_profiles"}
+            profile="$profile_cache/$(benchmark_hash).profile"
+            mkdir -p "$profile_cache"
+            # Concurrent jobs of a sweep wait for the one profiling pass
+            (
+                flock 9
+                if [[ ! -f $profile ]] ; then
+                    pin -t $BP_EXAMPLE/obj-intel64/branch_predictor.so \
+                        -profile_record "$profile.$$" -o /dev/null -- \
+                        "${bench_cmd[@]}" < "${bench_stdin:-/dev/null}" &&
+                        mv "$profile.$$" "$profile"
+                fi
+            ) 9> "$profile.lock" 1>&2
+            if [[ ! -f $profile ]] ; then
+                echo "Error: profiling $3 failed" >&2
+                exit 1
+            fi
+            knobs[$((i + 1))]=$profile
+        fi
+    done
+    if [[ -n $bench_stdin ]] ; then
+        exec < "$bench_stdin"
     fi
+    pin -t $BP_EXAMPLE/obj-intel64/branch_predictor.so "${knobs[@]}" -- "${bench_cmd[@]}"
 fi
 
 # pin -t $BP_EXAMPLE/obj-intel64/branch_predictor.so -BP_type $bp_type -o "$bp_type.out" -num_BP_entries $num_bp_entry -- ../tests/test.out
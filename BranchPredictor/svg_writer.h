@@ -0,0 +1,85 @@
+#ifndef SVG_WRITER_H
+#define SVG_WRITER_H
+
+// Minimal SVG document writer for the result charts
+//
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+class SvgWriter {
+  private:
+    double width;
+    double height;
+    std::ostringstream body;
+
+    static std::string Escape(const std::string &text) {
+        std::string escaped;
+        for (size_t i = 0; i < text.size(); i++) {
+            switch (text[i]) {
+            case '<': escaped += "&lt;"; break;
+            case '>': escaped += "&gt;"; break;
+            case '&': escaped += "&amp;"; break;
+            case '"': escaped += "&quot;"; break;
+            default: escaped += text[i];
+            }
+        }
+        return escaped;
+    }
+
+  public:
+    SvgWriter(double width, double height) : width(width), height(height) {
+        Rect(0, 0, width, height, "#ffffff");
+    }
+
+    void Rect(double x, double y, double w, double h, const std::string &fill) {
+        body << "<rect x=\"" << x << "\" y=\"" << y << "\" width=\"" << w
+             << "\" height=\"" << h << "\" fill=\"" << fill << "\"/>\n";
+    }
+
+    void Line(double x1, double y1, double x2, double y2,
+              const std::string &stroke, double strokeWidth = 1.0) {
+        body << "<line x1=\"" << x1 << "\" y1=\"" << y1 << "\" x2=\"" << x2
+             << "\" y2=\"" << y2 << "\" stroke=\"" << stroke
+             << "\" stroke-width=\"" << strokeWidth << "\"/>\n";
+    }
+
+    void Polyline(const std::vector<std::pair<double, double> > &points,
+                  const std::string &stroke, double strokeWidth = 2.0) {
+        body << "<polyline fill=\"none\" stroke=\"" << stroke
+             << "\" stroke-width=\"" << strokeWidth << "\" points=\"";
+        for (size_t i = 0; i < points.size(); i++)
+            body << (i ? " " : "") << points[i].first << "," << points[i].second;
+        body << "\"/>\n";
+    }
+
+    void Circle(double x, double y, double r, const std::string &fill) {
+        body << "<circle cx=\"" << x << "\" cy=\"" << y << "\" r=\"" << r
+             << "\" fill=\"" << fill << "\"/>\n";
+    }
+
+    // anchor is one of "start", "middle" or "end"
+    void Text(double x, double y, const std::string &text, double size = 12,
+              const std::string &anchor = "start", const std::string &fill = "#222222",
+              double rotate = 0) {
+        body << "<text x=\"" << x << "\" y=\"" << y << "\" font-family=\"Arial\" "
+             << "font-size=\"" << size << "\" text-anchor=\"" << anchor
+             << "\" fill=\"" << fill << "\"";
+        if (rotate != 0)
+            body << " transform=\"rotate(" << rotate << " " << x << " " << y << ")\"";
+        body << ">" << Escape(text) << "</text>\n";
+    }
+
+    bool Save(const std::string &path) {
+        std::ofstream file(path.c_str());
+        file << "<svg version=\"1.1\" xmlns=\"http://www.w3.org/2000/svg\" "
+             << "width=\"" << width << "\" height=\"" << height << "\" "
+             << "viewBox=\"0 0 " << width << " " << height << "\">\n"
+             << body.str() << "</svg>\n";
+        return file.good();
+    }
+};
+
+#endif // SVG_WRITER_H
@@ -0,0 +1,256 @@
+#!/bin/bash
+#
+# Run a matrix of branch predictor simulations concurrently and collect the
+# results into one CSV file.
+#
+# Usage: ./sweep.sh [-j jobs] [-m matrix] [-d outdir] [-c csv] [-C cpus] [-P]
+#                   [-R cachedir] [-N] [-p plotdir]
+#
+#   -j  number of simulations running at the same time (default: nproc)
+#   -m  experiment matrix, one "benchmark BP_type num_BP_entries [knobs...]"
+#       per line, '#' starts a comment. Without it every benchmark is run
+#       with local/gshare/tournament at 128/1024/4096 entries.
+#   -d  directory receiving one output file per job (default: sweep.out)
+#   -c  CSV file collecting the results (default: <outdir>/results.csv)
+#   -C  list of CPUs to pin jobs to, e.g. 0-7,16 (default: all allowed CPUs)
+#   -P  do not pin jobs to CPUs
+#   -R  result cache directory (default: $BP_RESULT_CACHE or
+#       ~/.cache/bp_results)
+#   -N  do not use the result cache
+#   -p  regenerate the result charts from the CSV into this directory,
+#       e.g. ../res
+#
+# Results are cached under a hash of the benchmark binary, its arguments and
+# input files, the pintool sources and the knobs of the job. A job whose hash
+# is in the cache is not run again. Jobs capturing a trace are never cached.
+
+jobs=$(nproc)
+matrix=''
+outdir='sweep.out'
+csv=''
+cpulist=''
+pinning=1
+cachedir=${BP_RESULT_CACHE:-"$HOME/.cache/bp_results"}
+caching=1
+plotdir=''
+
+while getopts 'j:m:d:c:C:PR:Np:' opt ; do
+    case $opt in
+        j) jobs=$OPTARG ;;
+        m) matrix=$OPTARG ;;
+        d) outdir=$OPTARG ;;
+        c) csv=$OPTARG ;;
+        C) cpulist=$OPTARG ;;
+        P) pinning=0 ;;
+        R) cachedir=$OPTARG ;;
+        N) caching=0 ;;
+        p) plotdir=$OPTARG ;;
+        *) sed -n '3,27p' "$0" | sed 's/^# \{0,1\}//' ; exit 1 ;;
+    esac
+done
+csv=${csv:-"$outdir/results.csv"}
+
+if ! command -v taskset > /dev/null ; then
+    pinning=0
+elif [[ -z $cpulist ]] ; then
+    # CPUs this script is allowed to run on, e.g. "0-3,8"
+    cpulist=$(taskset -cp $$ | sed 's/.*: //')
+fi
+cpus=()
+IFS=',' read -r -a ranges <<< "$cpulist"
+for range in "${ranges[@]}" ; do
+    cpus+=($(seq ${range%-*} ${range#*-}))
+done
+
+if [[ -z $SKIP_BUILD ]] ; then
+    mkdir -p obj-intel64/
+    make obj-intel64/branch_predictor.so TARGET=intel64 PIN_ROOT=$PIN_ROOT || exit 1
+fi
+mkdir -p "$outdir"
+if [[ $caching == 1 ]] ; then
+    mkdir -p "$cachedir"
+fi
+source ./benchmarks.sh
+
+# One job per matrix line: "benchmark BP_type num_BP_entries [knobs...]"
+experiments=()
+if [[ -n $matrix ]] ; then
+    while read -r line ; do
+        read -r -a words <<< "${line%%#*}"
+        if [[ ${#words[@]} -gt 0 ]] ; then
+            experiments+=("${words[*]}")
+        fi
+    done < "$matrix"
+else
+    for bench in sjeng gobmk gromacs ; do
+        for bp_type in 'local' 'gshare' 'tournament' ; do
+            for num_bp_entry in 128 1024 4096 ; do
+                experiments+=("$bench $bp_type $num_bp_entry")
+            done
+        done
+    done
+fi
+
+# Name of the output files of a job, unique per matrix line
+job_name() {
+    local name=${1// /_}
+    echo "${name//[^A-Za-z0-9_.=-]/}"
+}
+
+# Print a CSV field, quoted if it holds commas or quotes like a hybrid(...)
+# BP_type
+csv_field() {
+    if [[ $1 == *[,\"]* ]] ; then
+        local quoted=${1//\"/\"\"}
+        echo "\"$quoted\""
+    else
+        echo "$1"
+    fi
+}
+
+# Hash of the pintool sources, the predictor code is all in there, of its
+# build rules and of the scripts that run it
+tool_hash=$(cat branch_predictor.cpp *.h makefile.rules runsim.sh benchmarks.sh |
+    sha256sum | cut -d' ' -f1)
+
+# Knobs of jobs that are never cached, as they write side files that a cache
+# hit would not restore, or load a plugin predictor that is not part of the
+# tool hash
+uncached_knobs=(-trace -interval -interval_file -profile_record -bp_plugin)
+
+# Set key to the result cache key of a job, or to nothing if the job must not
+# be cached. Benchmark files are hashed once per benchmark, and the contents
+# of files passed as knob values, like a -profile_use profile, are hashed too.
+declare -A bench_hashes
+result_key() {
+    key=''
+    if [[ $caching == 0 ]] || ! set_benchmark $1 ; then
+        return
+    fi
+    local knob
+    for knob in "${uncached_knobs[@]}" ; do
+        if [[ " $* " == *" $knob "* ]] ; then
+            return
+        fi
+    done
+    if [[ -z ${bench_hashes[$1]} ]] ; then
+        bench_hashes[$1]=$(
+            sha256sum "${bench_cmd[0]}" "${bench_inputs[@]}" | cut -d' ' -f1
+            echo "${bench_cmd[@]:1}"
+        )
+    fi
+    local value knob_files=()
+    for value in "${@:4}" ; do
+        if [[ -f $value ]] ; then
+            knob_files+=("$value")
+        fi
+    done
+    key=$({
+        printf '%s\n' "$tool_hash" "${bench_hashes[$1]}" "${*:2}"
+        if [[ ${#knob_files[@]} -gt 0 ]] ; then
+            sha256sum "${knob_files[@]}" | cut -d' ' -f1
+        fi
+    } | sha256sum | cut -d' ' -f1)
+}
+
+# Value of a scalar in a pintool JSON stats file, which has one per line
+stat_value() {
+    sed -n "s/^ *\"$2\": \([^,{[]*\),\?\$/\1/p" "$1" 2>/dev/null | head -1
+}
+
+print_result() {
+    local accuracy=$(stat_value "$outdir/$(job_name "$*").out" accuracy)
+    printf '%-12.12s %-12.12s %-12.12s ' $2 $3 $1
+    echo "${accuracy:-failed}"
+}
+
+run_job() {
+    local cpu=$1 key=$2 ; shift 2
+    local bench=$1 bp_type=$2 num_bp_entry=$3
+    local name=$(job_name "$*")
+    local jobdir="$outdir/$name.d"
+    local launcher=()
+
+    # gromacs writes its outputs next to its input, so give every job a
+    # private copy of the input directory
+    mkdir -p "$jobdir"
+    if [[ $bench == 'gromacs' ]] ; then
+        ln -sf "$GROMACS_DATA/gromacs.tpr" "$jobdir/gromacs.tpr"
+    fi
+    if [[ $pinning == 1 && -n $cpu ]] ; then
+        launcher=(taskset -c "$cpu")
+    fi
+
+    local start=$(date +%s.%N)
+    GROMACS_DATA=$(realpath "$jobdir") SKIP_BUILD=1 "${launcher[@]}" \
+        ./runsim.sh $bp_type $num_bp_entry $bench "$outdir/$name.out" \
+        -stats_format json "${@:4}" \
+        > "$outdir/$name.log" 2>&1
+    local status=$?
+    local end=$(date +%s.%N)
+    echo "$status $(awk "BEGIN { print $end - $start }")" > "$outdir/$name.time"
+    if [[ -n $key && $status == 0 && -n $(stat_value "$outdir/$name.out" accuracy) ]] ; then
+        cp "$outdir/$name.out" "$cachedir/$key.out.$BASHPID"
+        cp "$outdir/$name.time" "$cachedir/$key.time"
+        mv "$cachedir/$key.out.$BASHPID" "$cachedir/$key.out"
+    fi
+    print_result "$@"
+}
+
+# Keep at most $jobs simulations running, each one on its own CPU slot
+slots=()
+for experiment in "${experiments[@]}" ; do
+    result_key $experiment
+    name=$(job_name "$experiment")
+    rm -f "$outdir/$name.cached"
+    if [[ -n $key && -f $cachedir/$key.out ]] ; then
+        cp "$cachedir/$key.out" "$outdir/$name.out"
+        cp "$cachedir/$key.time" "$outdir/$name.time"
+        touch "$outdir/$name.cached"
+        print_result $experiment
+        continue
+    fi
+
+    while true ; do
+        for ((slot = 0; slot < jobs; slot++)) ; do
+            if [[ -z ${slots[$slot]} ]] || ! kill -0 ${slots[$slot]} 2> /dev/null ; then
+                break 2
+            fi
+        done
+        wait -n
+    done
+    cpu=''
+    if [[ $pinning == 1 && ${#cpus[@]} -gt 0 ]] ; then
+        cpu=${cpus[$((slot % ${#cpus[@]}))]}
+    fi
+    run_job "$cpu" "$key" $experiment &
+    slots[$slot]=$!
+done
+wait
+
+stats=(accuracy mpki conditional_branches correct_predictions taken_branches
+       not_taken_branches predicted_taken_branches predicted_not_taken_branches
+       instructions storage_bits simulated_mips)
+header=$(IFS=, ; echo "${stats[*]}")
+echo "benchmark,bp_type,num_bp_entries,knobs,$header,wall_seconds,status,cached" > "$csv"
+for experiment in "${experiments[@]}" ; do
+    set -- $experiment
+    name=$(job_name "$experiment")
+    out="$outdir/$name.out"
+    read -r status wall < "$outdir/$name.time"
+    cached=0
+    if [[ -f $outdir/$name.cached ]] ; then
+        cached=1
+    fi
+    values=()
+    for stat in "${stats[@]}" ; do
+        values+=("$(stat_value "$out" $stat)")
+    done
+    echo "$1,$(csv_field "$2"),$3,$(csv_field "${*:4}"),$(IFS=, ; echo "${values[*]}"),$wall,$status,$cached" >> "$csv"
+done
+echo "Results written to $csv"
+
+if [[ -n $plotdir ]] ; then
+    make obj-intel64/bp_plot.exe TARGET=intel64 PIN_ROOT=$PIN_ROOT > /dev/null &&
+        obj-intel64/bp_plot.exe -d "$plotdir" "$csv"
+fi
@@ -0,0 +1,133 @@
+#ifndef TRACE_CODEC_H
+#define TRACE_CODEC_H
+
+// Self-contained LZ77 byte codec used for the streams of compressed branch
+// traces. A compressed block is a series of sequences, each made of a token
+// byte (literal length in the high nibble, match length minus 4 in the low
+// nibble, 15 meaning that 255-terminated extension bytes follow), the
+// literals and a 16-bit little-endian match offset. The last sequence only
+// has literals.
+//
+#include "branch_predictors.h"
+#include <string.h>
+
+#define TRACE_CODEC_HASH_BITS 14
+#define TRACE_CODEC_MIN_MATCH 4
+#define TRACE_CODEC_MAX_OFFSET 65535
+
+inline UINT32 TraceCodecRead32(const UINT8 *p) {
+    UINT32 value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline void TraceCodecWriteLength(std::vector<UINT8> &out, size_t length) {
+    for (; length >= 255; length -= 255)
+        out.push_back(255);
+    out.push_back(length);
+}
+
+inline void TraceCodecWriteSequence(std::vector<UINT8> &out,
+                                    const UINT8 *literals, size_t literalLength,
+                                    size_t offset, size_t matchLength) {
+    size_t matchCode = matchLength ? matchLength - TRACE_CODEC_MIN_MATCH : 0;
+    out.push_back((std::min<size_t>(literalLength, 15) << 4) |
+                  std::min<size_t>(matchCode, 15));
+    if (literalLength >= 15)
+        TraceCodecWriteLength(out, literalLength - 15);
+    out.insert(out.end(), literals, literals + literalLength);
+    if (matchLength == 0)
+        return;
+    out.push_back(offset & 0xff);
+    out.push_back(offset >> 8);
+    if (matchCode >= 15)
+        TraceCodecWriteLength(out, matchCode - 15);
+}
+
+// Compress size bytes of in, replacing the contents of out
+//
+inline void TraceCodecCompress(const UINT8 *in, size_t size,
+                               std::vector<UINT8> &out) {
+    std::vector<UINT32> table(1 << TRACE_CODEC_HASH_BITS, 0);
+    size_t anchor = 0;
+    size_t i = 0;
+
+    out.clear();
+    while (i + TRACE_CODEC_MIN_MATCH <= size) {
+        UINT32 sequence = TraceCodecRead32(in + i);
+        UINT32 hash = (sequence * 2654435761U) >> (32 - TRACE_CODEC_HASH_BITS);
+        // table entries hold the position plus one, zero is empty
+        size_t candidate = table[hash];
+        table[hash] = i + 1;
+
+        if (candidate == 0 || i - (candidate - 1) > TRACE_CODEC_MAX_OFFSET ||
+            TraceCodecRead32(in + candidate - 1) != sequence) {
+            i++;
+            continue;
+        }
+        candidate--;
+
+        size_t matchLength = TRACE_CODEC_MIN_MATCH;
+        while (i + matchLength < size &&
+               in[candidate + matchLength] == in[i + matchLength])
+            matchLength++;
+
+        TraceCodecWriteSequence(out, in + anchor, i - anchor, i - candidate,
+                                matchLength);
+        i += matchLength;
+        anchor = i;
+    }
+    TraceCodecWriteSequence(out, in + anchor, size - anchor, 0, 0);
+}
+
+inline bool TraceCodecReadLength(const UINT8 *&in, const UINT8 *end,
+                                 size_t &length) {
+    UINT8 byte;
+    do {
+        if (in == end)
+            return false;
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Decompress size bytes of in into exactly outSize bytes of out, returns
+// false if the block is corrupt
+//
+inline bool TraceCodecDecompress(const UINT8 *in, size_t size, UINT8 *out,
+                                 size_t outSize) {
+    const UINT8 *end = in + size;
+    size_t written = 0;
+
+    while (in < end) {
+        UINT8 token = *in++;
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && !TraceCodecReadLength(in, end, literalLength))
+            return false;
+        if (literalLength > (size_t)(end - in) || literalLength > outSize - written)
+            return false;
+        memcpy(out + written, in, literalLength);
+        in += literalLength;
+        written += literalLength;
+        if (in == end)
+            break;
+
+        if (end - in < 2)
+            return false;
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !TraceCodecReadLength(in, end, matchLength))
+            return false;
+        matchLength += TRACE_CODEC_MIN_MATCH;
+        if (offset == 0 || offset > written || matchLength > outSize - written)
+            return false;
+        // byte by byte, matches may overlap the bytes they produce
+        for (size_t i = 0; i < matchLength; i++, written++)
+            out[written] = out[written - offset];
+    }
+    return written == outSize;
+}
+
+#endif // TRACE_CODEC_H
@@ -0,0 +1,430 @@
+#ifndef TRACE_REPLAY_H
+#define TRACE_REPLAY_H
+
+// Offline replay of captured branch traces. One reader hands out the trace
+// as a bounded ring of chunks which worker threads, each owning a group of
+// predictor configurations, consume in order. Reading overlaps simulation,
+// and at most inflightChunks chunks are in flight at any time.
+//
+// Gshare and bimodal configurations are replayed in lanes: up to
+// REPLAY_MAX_LANES of them step through every branch together.
+//
+#include "branch_predictors.h"
+#include "branch_trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Maximum number of configurations replayed together in lanes
+//
+#define REPLAY_MAX_LANES 64
+
+// Number of branches a predictor is given at once by ReplayRecords()
+//
+#define REPLAY_BATCH_BRANCHES 1024
+
+// Counters gathered while replaying a trace through one predictor
+//
+struct ReplayStats {
+    UINT64 conditionalBranchesCount;
+    UINT64 correctPredictionCount;
+    UINT64 takenBranchesCount;
+    UINT64 notTakenBranchesCount;
+    UINT64 predictedTakenBranchesCount;
+    UINT64 predictedNotTakenBranchesCount;
+
+    ReplayStats()
+        : conditionalBranchesCount(0), correctPredictionCount(0),
+          takenBranchesCount(0), notTakenBranchesCount(0),
+          predictedTakenBranchesCount(0), predictedNotTakenBranchesCount(0) {}
+
+    ReplayStats &operator+=(const ReplayStats &other) {
+        conditionalBranchesCount += other.conditionalBranchesCount;
+        correctPredictionCount += other.correctPredictionCount;
+        takenBranchesCount += other.takenBranchesCount;
+        notTakenBranchesCount += other.notTakenBranchesCount;
+        predictedTakenBranchesCount += other.predictedTakenBranchesCount;
+        predictedNotTakenBranchesCount += other.predictedNotTakenBranchesCount;
+        return *this;
+    }
+};
+
+// One predictor configuration taking part in a replay
+//
+struct ReplayConfig {
+    std::string spec;
+    BranchPredictorInterface *predictor;
+    ReplayStats stats;
+};
+
+// Predict and train on every record, exactly as the pintool does for every
+// executed conditional branch, in batches of REPLAY_BATCH_BRANCHES so that
+// plugin predictors are called once per batch
+//
+inline void ReplayRecords(BranchPredictorInterface *predictor,
+                          const UINT64 *records, size_t count,
+                          ReplayStats &stats) {
+    UINT8 predictions[REPLAY_BATCH_BRANCHES];
+    for (size_t first = 0; first < count; first += REPLAY_BATCH_BRANCHES) {
+        size_t batchCount = std::min(count - first, (size_t)REPLAY_BATCH_BRANCHES);
+        predictor->trainBatch(records + first, batchCount, predictions);
+        for (size_t i = 0; i < batchCount; i++) {
+            bool branchWasTaken = BranchRecordTaken(records[first + i]);
+            bool wasPredictedTaken = predictions[i];
+
+            stats.predictedTakenBranchesCount += wasPredictedTaken;
+            stats.takenBranchesCount += branchWasTaken;
+            stats.correctPredictionCount += wasPredictedTaken == branchWasTaken;
+        }
+    }
+    stats.conditionalBranchesCount += count;
+    stats.predictedNotTakenBranchesCount =
+        stats.conditionalBranchesCount - stats.predictedTakenBranchesCount;
+    stats.notTakenBranchesCount =
+        stats.conditionalBranchesCount - stats.takenBranchesCount;
+}
+
+// Replay of up to REPLAY_MAX_LANES gshare and bimodal configurations at
+// once. A bimodal predictor is a gshare predictor without history, and they
+// all shift the same outcomes into the same global history, so every branch
+// is decoded and the history updated once for all lanes. Each lane has its
+// own counter table; the indices, predictions and counter updates of all
+// lanes are computed in loops over the lanes without branches, and the index
+// and counting loops vectorize. Only histories that need no folding are
+// supported, so that the index is (PC ^ history) & mask.
+//
+class LaneReplay {
+  private:
+    std::vector<ReplayConfig *> configs;
+    std::vector<UINT8> counters; // the tables of all lanes, one after the other
+    UINT64 tableBase[REPLAY_MAX_LANES];
+    ADDRINT indexMask[REPLAY_MAX_LANES];
+    ADDRINT historyMask[REPLAY_MAX_LANES];
+    UINT8 saturatorMax[REPLAY_MAX_LANES];
+    ADDRINT GHR;
+
+    // The spec's entries, history length and counter width, false when it
+    // cannot be replayed in a lane
+    static bool ParseLaneSpec(const std::string &spec, UINT64 &numberOfEntries,
+                              UINT32 &historyLength, UINT32 &counterBits) {
+        std::string type;
+        BranchPredictorParams params;
+        historyLength = 0;
+        counterBits = 2;
+        if (!ParsePredictorSpec(spec, type, numberOfEntries, params) ||
+            UnsupportedPredictorParams(type, params) != 0)
+            return false;
+        UINT32 indexBits = IndexBits(numberOfEntries);
+        if (params.counterBits)
+            counterBits = params.counterBits;
+        if (type == "bimodal")
+            return true;
+        historyLength = params.historyLength ? params.historyLength : indexBits;
+        return type == "gshare" && historyLength <= indexBits;
+    }
+
+  public:
+    LaneReplay() : GHR(0) {}
+
+    // True when the configuration can be replayed in a lane
+    static bool Supports(const std::string &spec) {
+        UINT64 numberOfEntries;
+        UINT32 historyLength, counterBits;
+        return ParseLaneSpec(spec, numberOfEntries, historyLength, counterBits);
+    }
+
+    // Add a lane for a supported configuration, before the replay starts
+    void Add(ReplayConfig *config) {
+        UINT64 numberOfEntries;
+        UINT32 historyLength, counterBits;
+        ParseLaneSpec(config->spec, numberOfEntries, historyLength, counterBits);
+
+        size_t lane = configs.size();
+        configs.push_back(config);
+        tableBase[lane] = counters.size();
+        indexMask[lane] = LsbMask(IndexBits(numberOfEntries));
+        historyMask[lane] = LsbMask(historyLength);
+        saturatorMax[lane] = LsbMask(counterBits);
+        counters.resize(counters.size() + numberOfEntries, saturatorMax[lane]);
+    }
+
+    size_t Size() const { return configs.size(); }
+
+    // Predict and train every lane on every record, exactly as ReplayRecords()
+    // does with the predictor of each configuration
+    void Replay(const UINT64 *records, size_t count) {
+        size_t lanes = configs.size();
+        UINT64 correct[REPLAY_MAX_LANES] = {0};
+        UINT64 predictedTaken[REPLAY_MAX_LANES] = {0};
+        UINT64 index[REPLAY_MAX_LANES];
+        UINT8 prediction[REPLAY_MAX_LANES];
+        UINT8 *table = &counters[0];
+        UINT64 takenCount = 0;
+
+        for (size_t i = 0; i < count; i++) {
+            ADDRINT branchPC = BranchRecordPC(records[i]);
+            UINT8 branchWasTaken = BranchRecordTaken(records[i]);
+
+            for (size_t lane = 0; lane < lanes; lane++)
+                index[lane] = tableBase[lane] +
+                              ((branchPC ^ (GHR & historyMask[lane])) & indexMask[lane]);
+
+            for (size_t lane = 0; lane < lanes; lane++) {
+                UINT8 saturator = table[index[lane]];
+                prediction[lane] = saturator > saturatorMax[lane] / 2;
+                table[index[lane]] = saturator +
+                                     (branchWasTaken & (saturator < saturatorMax[lane])) -
+                                     (!branchWasTaken & (saturator > 0));
+            }
+
+            for (size_t lane = 0; lane < lanes; lane++) {
+                predictedTaken[lane] += prediction[lane];
+                correct[lane] += prediction[lane] == branchWasTaken;
+            }
+            GHR = (GHR << 1) | branchWasTaken;
+            takenCount += branchWasTaken;
+        }
+
+        for (size_t lane = 0; lane < lanes; lane++) {
+            ReplayStats &stats = configs[lane]->stats;
+            stats.conditionalBranchesCount += count;
+            stats.correctPredictionCount += correct[lane];
+            stats.takenBranchesCount += takenCount;
+            stats.predictedTakenBranchesCount += predictedTaken[lane];
+            stats.predictedNotTakenBranchesCount =
+                stats.conditionalBranchesCount - stats.predictedTakenBranchesCount;
+            stats.notTakenBranchesCount =
+                stats.conditionalBranchesCount - stats.takenBranchesCount;
+        }
+    }
+};
+
+class ParallelReplay {
+  private:
+    struct TraceChunk {
+        std::vector<UINT64> buffer;
+        const UINT64 *records;
+        size_t count;
+        unsigned pendingWorkers;
+    };
+
+    size_t chunkRecords;
+    std::vector<TraceChunk> chunks;
+    unsigned workerCount;
+    size_t maxLanes;
+
+    std::mutex lock;
+    std::condition_variable chunkProduced;
+    std::condition_variable chunkConsumed;
+    UINT64 producedChunks;
+    bool traceDone;
+
+    void Worker(std::vector<ReplayConfig *> configs,
+                std::vector<LaneReplay *> laneGroups) {
+        for (UINT64 sequence = 0;; sequence++) {
+            TraceChunk *chunk;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                chunkProduced.wait(guard, [&] {
+                    return producedChunks > sequence || traceDone;
+                });
+                if (producedChunks <= sequence)
+                    return;
+                chunk = &chunks[sequence % chunks.size()];
+            }
+
+            for (size_t i = 0; i < configs.size(); i++) {
+                ReplayRecords(configs[i]->predictor, chunk->records,
+                              chunk->count, configs[i]->stats);
+            }
+            for (size_t i = 0; i < laneGroups.size(); i++)
+                laneGroups[i]->Replay(chunk->records, chunk->count);
+
+            std::lock_guard<std::mutex> guard(lock);
+            if (--chunk->pendingWorkers == 0)
+                chunkConsumed.notify_one();
+        }
+    }
+
+  public:
+    // maxLanes limits the lanes of a lane group, 0 replays every
+    // configuration with its own predictor
+    ParallelReplay(size_t chunkRecords, size_t inflightChunks, unsigned threads,
+                   size_t maxLanes = REPLAY_MAX_LANES)
+        : chunkRecords(chunkRecords), chunks(inflightChunks),
+          workerCount(threads), maxLanes(std::min<size_t>(maxLanes, REPLAY_MAX_LANES)),
+          producedChunks(0), traceDone(false) {
+        for (size_t i = 0; i < chunks.size(); i++)
+            chunks[i].pendingWorkers = 0;
+    }
+
+    // Replay the whole trace through every configuration, the predictors and
+    // lane groups of each worker run one after the other on every chunk
+    void Run(BranchTraceReader &reader, std::vector<ReplayConfig> &configs) {
+        std::vector<ReplayConfig *> laneConfigs, otherConfigs;
+        for (size_t i = 0; i < configs.size(); i++) {
+            if (maxLanes > 0 && LaneReplay::Supports(configs[i].spec))
+                laneConfigs.push_back(&configs[i]);
+            else
+                otherConfigs.push_back(&configs[i]);
+        }
+
+        // As many lane groups as workers, unless they would be too wide
+        size_t laneGroupCount = 0;
+        if (!laneConfigs.empty())
+            laneGroupCount = std::max((laneConfigs.size() + maxLanes - 1) / maxLanes,
+                                      std::min<size_t>(workerCount, laneConfigs.size()));
+        std::vector<LaneReplay> laneGroups(laneGroupCount);
+        for (size_t i = 0; i < laneConfigs.size(); i++)
+            laneGroups[i % laneGroupCount].Add(laneConfigs[i]);
+
+        unsigned workers =
+            std::min<size_t>(workerCount, otherConfigs.size() + laneGroupCount);
+        std::vector<std::vector<ReplayConfig *> > groups(workers);
+        std::vector<std::vector<LaneReplay *> > workerLaneGroups(workers);
+        for (size_t i = 0; i < laneGroupCount; i++)
+            workerLaneGroups[i % workers].push_back(&laneGroups[i]);
+        for (size_t i = 0; i < otherConfigs.size(); i++)
+            groups[(laneGroupCount + i) % workers].push_back(otherConfigs[i]);
+
+        std::vector<std::thread> threads;
+        for (unsigned w = 0; w < workers; w++)
+            threads.push_back(std::thread(&ParallelReplay::Worker, this, groups[w],
+                                          workerLaneGroups[w]));
+
+        for (UINT64 sequence = 0;; sequence++) {
+            TraceChunk &chunk = chunks[sequence % chunks.size()];
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                chunkConsumed.wait(guard, [&] { return chunk.pendingWorkers == 0; });
+            }
+
+            chunk.count = chunkRecords;
+            chunk.records = reader.Next(chunk.buffer, chunk.count);
+            if (chunk.count == 0)
+                break;
+
+            std::lock_guard<std::mutex> guard(lock);
+            chunk.pendingWorkers = workers;
+            producedChunks++;
+            chunkProduced.notify_all();
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            traceDone = true;
+            chunkProduced.notify_all();
+        }
+        for (unsigned w = 0; w < workers; w++)
+            threads[w].join();
+    }
+};
+
+// Run job(i) for every i below jobCount on up to threadCount threads, handing
+// out jobs in order
+//
+template <typename Job>
+inline void ParallelFor(size_t jobCount, unsigned threadCount, Job job) {
+    std::atomic<size_t> nextJob(0);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < std::min<size_t>(threadCount, jobCount); t++) {
+        threads.push_back(std::thread([&] {
+            for (size_t j = nextJob++; j < jobCount; j = nextJob++)
+                job(j);
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+}
+
+// Replay count branches of the trace starting at branch first, returns false
+// if the trace ends early
+//
+inline bool ReplayRange(BranchTraceReader &reader,
+                        BranchPredictorInterface *predictor, UINT64 first,
+                        UINT64 count, ReplayStats &stats) {
+    std::vector<UINT64> buffer;
+    reader.Seek(first);
+    while (count > 0) {
+        size_t readCount = std::min<UINT64>(count, COMPRESSED_TRACE_BLOCK_BRANCHES);
+        const UINT64 *records = reader.Next(buffer, readCount);
+        if (readCount == 0)
+            return false;
+        readCount = std::min<UINT64>(readCount, count);
+        ReplayRecords(predictor, records, readCount, stats);
+        count -= readCount;
+    }
+    return true;
+}
+
+// Approximate replay for long traces. The trace is split into segments that
+// are replayed in parallel, each by a fresh predictor first warmed up on the
+// warmupBranches branches preceding its segment. Warmup branches are not
+// counted, and the counters of all segments are summed.
+//
+class SegmentedReplay {
+  private:
+    struct SegmentJob {
+        ReplayConfig *config;
+        UINT64 warmupFirst;
+        UINT64 first;
+        UINT64 count;
+        ReplayStats stats;
+        bool failed;
+    };
+
+    std::string tracePath;
+    unsigned segmentCount;
+    UINT64 warmupBranches;
+    unsigned threadCount;
+
+    void RunJob(SegmentJob &job) {
+        BranchTraceReader reader;
+        BranchPredictorInterface *predictor = CreatePredictorFromSpec(job.config->spec);
+        ReplayStats warmupStats;
+
+        job.failed = predictor == NULL || !reader.Open(tracePath) ||
+                     !ReplayRange(reader, predictor, job.warmupFirst,
+                                  job.first - job.warmupFirst, warmupStats) ||
+                     !ReplayRange(reader, predictor, job.first, job.count, job.stats);
+        delete predictor;
+    }
+
+  public:
+    SegmentedReplay(const std::string &tracePath, unsigned segments,
+                    UINT64 warmupBranches, unsigned threads)
+        : tracePath(tracePath), segmentCount(segments),
+          warmupBranches(warmupBranches), threadCount(threads) {}
+
+    // Replay the first branchCount branches of the trace through every
+    // configuration, returns false if the trace could not be read
+    bool Run(std::vector<ReplayConfig> &configs, UINT64 branchCount) {
+        std::vector<SegmentJob> jobs;
+        for (size_t i = 0; i < configs.size(); i++) {
+            for (unsigned segment = 0; segment < segmentCount; segment++) {
+                SegmentJob job;
+                job.config = &configs[i];
+                job.first = branchCount * segment / segmentCount;
+                job.count = branchCount * (segment + 1) / segmentCount - job.first;
+                job.warmupFirst = job.first - std::min(job.first, warmupBranches);
+                job.failed = false;
+                jobs.push_back(job);
+            }
+        }
+
+        ParallelFor(jobs.size(), threadCount, [&](size_t j) { RunJob(jobs[j]); });
+
+        bool failed = false;
+        for (size_t j = 0; j < jobs.size(); j++) {
+            jobs[j].config->stats += jobs[j].stats;
+            failed |= jobs[j].failed;
+        }
+        return !failed;
+    }
+};
+
+#endif // TRACE_REPLAY_H
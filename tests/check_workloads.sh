@@ -0,0 +1,56 @@
+#!/bin/bash
+#
+# Usage: ./check_workloads.sh [-t tolerance] [-d outdir]
+#
+# Runs every line of workloads/expected_accuracy.txt under the pintool and
+# fails if an accuracy is further than the tolerance (default 0.02) from the
+# expected one. Also prints the simulation speed of every run. Set
+# SKIP_BUILD=1 to reuse an already built pintool.
+
+tolerance=0.02
+outdir=workloads/results
+while getopts "t:d:" opt ; do
+    case $opt in
+        t) tolerance=$OPTARG ;;
+        d) outdir=$OPTARG ;;
+        *) exit 1 ;;
+    esac
+done
+
+mkdir -p "$outdir"
+outdir=$(realpath "$outdir")
+cd "$(dirname "$0")/../BranchPredictor" || exit 1
+if [[ -z $SKIP_BUILD ]] ; then
+    make obj-intel64/branch_predictor.so TARGET=intel64 PIN_ROOT=$PIN_ROOT > /dev/null || exit 1
+fi
+
+# Value of a scalar in a pintool JSON stats file
+stat_value() {
+    sed -n "s/^ *\"$2\": \([^,{[]*\),\?$/\1/p" "$1" 2>/dev/null | head -1
+}
+
+failures=0
+while read -r workload bp_type num_bp_entries expected ; do
+    if [[ -z $workload || $workload == \#* ]] ; then
+        continue
+    fi
+    out="$outdir/${workload}_${bp_type}_$num_bp_entries.json"
+    SKIP_BUILD=1 ./runsim.sh $bp_type $num_bp_entries $workload "$out" \
+        -stats_format json > "${out%.json}.log" 2>&1
+    accuracy=$(stat_value "$out" accuracy)
+    mips=$(stat_value "$out" simulated_mips)
+    if [[ -n $accuracy ]] && awk "BEGIN { d = $accuracy - $expected; exit !(d <= $tolerance && -d <= $tolerance) }" ; then
+        result=PASS
+    else
+        result=FAIL
+        failures=$((failures + 1))
+    fi
+    printf '%-4s %-12s %-14s %-8s accuracy %-8s expected %-8s %s MIPS\n' \
+        $result $workload $bp_type $num_bp_entries "${accuracy:-none}" $expected "${mips:-?}"
+done < ../tests/workloads/expected_accuracy.txt
+
+if [[ $failures != 0 ]] ; then
+    echo "$failures workload checks failed"
+    exit 1
+fi
+echo "All workload checks passed"
@@ -0,0 +1,23 @@
+// Periodic patterns: one branch alternates every iteration and one is not
+// taken every third iteration.
+//
+// History-based predictors learn both; always taken is right half of the time
+// on the first, two times out of three on the second and always on the loop.
+//
+#include <cstdio>
+
+#define ITERATIONS 4000000
+
+int main() {
+    long odd = 0, third = 0;
+    for (long i = 0; i < ITERATIONS; i++) {
+        if (i & 1) {
+            odd++;
+        }
+        if (i % 3 == 0) {
+            third++;
+        }
+    }
+    printf("%ld %ld\n", odd, third);
+    return 0;
+}
@@ -0,0 +1,35 @@
+// Correlated if-chain: two branches on random bits a and b, then one on a ^ b.
+//
+// The third branch is decided by the outcomes of the first two, which global
+// history sees and local history does not. gshare and tournament are right on
+// the loop and the third branch and half of the time on the random ones;
+// local and always taken are right half of the time on all three.
+//
+#include <cstdio>
+
+#define ITERATIONS 3000000
+
+int main() {
+    unsigned long long state = 88172645463325252ULL;
+    long x = 0, y = 0, z = 0;
+    for (long i = 0; i < ITERATIONS; i++) {
+        // xorshift64
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        int a = state & 1;
+        int b = (state >> 1) & 1;
+
+        if (a) {
+            x++;
+        }
+        if (b) {
+            y++;
+        }
+        if (a ^ b) {
+            z++;
+        }
+    }
+    printf("%ld %ld %ld\n", x, y, z);
+    return 0;
+}
@@ -0,0 +1,56 @@
+// Switch-heavy bytecode interpreter running a counted loop of 4 iterations.
+//
+// Every dispatch runs the jump table bounds check of the switch (never
+// taken), the JNZ handler tests the counter (taken when it reaches zero) and
+// the outer loop runs the program again. The 19-branch pattern of one run is
+// learnt by history-based predictors; always taken is only right on the
+// loop exit of the program and on the outer loop.
+//
+#include <cstdio>
+
+#define RUNS 1000000
+#define LOOP_COUNT 4
+
+enum Opcode { OP_LOAD, OP_ADD, OP_DEC, OP_JNZ, OP_HALT };
+
+// counter = LOOP_COUNT; do { acc += counter; } while (--counter != 0);
+static const int program[] = {OP_LOAD, LOOP_COUNT, OP_ADD, OP_DEC,
+                              OP_JNZ,  2,          OP_HALT};
+
+static long Run(const int *code) {
+    long acc = 0, counter = 0;
+    int pc = 0;
+    for (;;) {
+        switch (code[pc]) {
+        case OP_LOAD:
+            counter = code[pc + 1];
+            pc += 2;
+            break;
+        case OP_ADD:
+            acc += counter;
+            pc += 1;
+            break;
+        case OP_DEC:
+            counter -= 1;
+            pc += 1;
+            break;
+        case OP_JNZ:
+            pc += 2;
+            if (counter != 0) {
+                pc = code[pc - 1];
+            }
+            break;
+        case OP_HALT:
+            return acc;
+        }
+    }
+}
+
+int main() {
+    long sum = 0;
+    for (long i = 0; i < RUNS; i++) {
+        sum += Run(program);
+    }
+    printf("%ld\n", sum);
+    return 0;
+}
@@ -0,0 +1,21 @@
+// Fixed-trip loops: an inner loop of 4 iterations inside an outer loop.
+//
+// Every outer iteration runs the inner loop condition 5 times (4 taken, 1 not
+// taken) and the outer loop condition once (taken). History-based predictors
+// learn the period-6 pattern; always taken is right 5 times out of 6.
+//
+#include <cstdio>
+
+#define OUTER_ITERATIONS 2000000
+#define INNER_ITERATIONS 4
+
+int main() {
+    long sum = 0;
+    for (long i = 0; i < OUTER_ITERATIONS; i++) {
+        for (long j = 0; j < INNER_ITERATIONS; j++) {
+            sum += j;
+        }
+    }
+    printf("%ld\n", sum);
+    return 0;
+}
@@ -0,0 +1,31 @@
+// Random data-dependent branch, true for 70% of the data.
+//
+// No history helps, so every counter-based predictor behaves like a 2-bit
+// saturating counter on independent outcomes that are 70% "not taken" (the
+// branch skips the increment). Its stationary distribution is proportional to
+// r^i for state i with r = 0.7 / 0.3, so it predicts the likely outcome with
+// probability (r^2 + r^3) / (1 + r + r^2 + r^3) = 0.845 and is right
+// 0.845 * 0.7 + 0.155 * 0.3 = 0.638 of the time. Always taken is right 30% of
+// the time on this branch, and every predictor is right on the loop.
+//
+#include <cstdio>
+
+#define ITERATIONS 4000000
+#define PERCENT_TRUE 70
+
+int main() {
+    unsigned long long state = 88172645463325252ULL;
+    long count = 0;
+    for (long i = 0; i < ITERATIONS; i++) {
+        // xorshift64
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        if (state % 100 < PERCENT_TRUE) {
+            count++;
+        }
+    }
+    printf("%ld\n", count);
+    return 0;
+}
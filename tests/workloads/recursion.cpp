@@ -0,0 +1,26 @@
+// Deep recursion: a function recurses 64 levels deep before returning.
+//
+// The recursion test is taken 64 times and not taken once per descent, too
+// far apart for any history to see the exit coming, so every predictor
+// misses exactly the exit: 65 right out of 66 branches with the outer loop.
+//
+#include <cstdio>
+
+#define DESCENTS 200000
+#define DEPTH 64
+
+static long Descend(long depth) {
+    if (depth == 0) {
+        return 0;
+    }
+    return 1 + Descend(depth - 1);
+}
+
+int main() {
+    long sum = 0;
+    for (long i = 0; i < DESCENTS; i++) {
+        sum += Descend(DEPTH);
+    }
+    printf("%ld\n", sum);
+    return 0;
+}